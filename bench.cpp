@@ -0,0 +1,675 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include "storage.hpp"
+#include "concurrent_storage.hpp"
+#include "btree.hpp"
+#include "wal.hpp"
+#include "mapped_tree.hpp"
+#include "paged_btree.hpp"
+#include "sharded.hpp"
+#include "persistent.hpp"
+
+using namespace std;
+using namespace chrono;
+
+// Random keys long enough to live outside the string, like the test data
+// once it grows past the small string buffer.
+vector<string> random_strings(size_t _count, size_t _length, mt19937_64& _rng)
+{
+    vector<string> result(_count, string(_length, '\0'));
+
+    for (string& str : result)
+        for (char& c : str)
+            c = static_cast<char>(_rng());
+    return result;
+}
+
+double ns_per_op(nanoseconds _total, size_t _ops)
+{
+    return static_cast<double>(_total.count()) / _ops;
+}
+
+// Random rank lookups and inserts on a tree well past the last level
+// cache, once per prefetch depth.
+void bench_prefetch(size_t _size, size_t _ops)
+{
+    mt19937_64 rng(42);
+    vector<string> keys = random_strings(_size, 24, rng);
+    vector<string> extra = random_strings(_ops, 24, rng);
+    vector<size_t> ranks(_ops);
+
+    cout << "prefetch: " << _size << " strings, " << _ops << " ops per run" << endl;
+    for (int depth = 0; depth <= 2; depth++)
+    {
+        RedBlackTree<string> tree;
+
+        tree.setPrefetch(depth);
+        for (const string& key : keys)
+            tree.insert(key);
+        for (size_t& rank : ranks)
+            rank = rng() % tree.size();
+
+        time_point<steady_clock> start = steady_clock::now();
+        size_t checksum = 0;
+
+        for (size_t rank : ranks)
+            checksum += tree.find(rank)->data[0];
+        nanoseconds find_time = steady_clock::now() - start;
+
+        start = steady_clock::now();
+        for (const string& key : extra)
+            tree.insert(key);
+        nanoseconds insert_time = steady_clock::now() - start;
+
+        cout << "  depth " << depth
+             << ": findByIndex " << ns_per_op(find_time, _ops) << " ns"
+             << ", insert " << ns_per_op(insert_time, _ops) << " ns"
+             << " (" << checksum % 10 << ")" << endl;
+    }
+}
+
+// One writer thread replaces a string (erase + insert) every 10us while
+// _readers threads call get for _duration; returns reads per second.
+template <typename Read, typename Write>
+double read_throughput(unsigned _readers, size_t _size, milliseconds _duration, Read _read, Write _write)
+{
+    atomic<bool> stop(false);
+    atomic<uint64_t> reads(0);
+    vector<thread> threads;
+
+    threads.emplace_back([&]() {
+        mt19937_64 rng(1);
+
+        while (!stop.load(memory_order_relaxed))
+        {
+            _write(rng() % _size, rng);
+            this_thread::sleep_for(microseconds(10));
+        }
+    });
+    for (unsigned t = 0; t < _readers; t++)
+    {
+        threads.emplace_back([&, t]() {
+            mt19937_64 rng(100 + t);
+            uint64_t done = 0;
+            size_t checksum = 0;
+
+            while (!stop.load(memory_order_relaxed))
+            {
+                checksum += _read(rng() % _size).size();
+                done++;
+            }
+            reads += done + (checksum == 0);
+        });
+    }
+    this_thread::sleep_for(_duration);
+    stop = true;
+    for (thread& t : threads)
+        t.join();
+    return (reads * 1000.0 / _duration.count());
+}
+
+// Read throughput against one busy writer: optimistic readers of
+// concurrent_storage next to readers queueing on one mutex around storage.
+void bench_concurrent(size_t _size)
+{
+    mt19937_64 rng(7);
+    vector<string> keys = random_strings(_size, 24, rng);
+    concurrent_storage shared;
+    storage locked;
+    mutex lock;
+    unsigned cores = max(2u, thread::hardware_concurrency());
+
+    for (const string& key : keys)
+    {
+        shared.insert(key);
+        locked.insert(key);
+    }
+
+    cout << "concurrent: " << _size << " strings, 1 writer, reads/s" << endl;
+    for (unsigned readers = 1; readers < cores; readers *= 2)
+    {
+        double optimistic = read_throughput(readers, _size, milliseconds(500),
+            [&](uint64_t _index) { return (shared.get(_index)); },
+            [&](uint64_t _index, mt19937_64& _rng) {
+                shared.erase(_index);
+                shared.insert(string(24, static_cast<char>(_rng())));
+            });
+        double mutexed = read_throughput(readers, _size, milliseconds(500),
+            [&](uint64_t _index) { lock_guard<mutex> guard(lock); return (locked.get(_index)); },
+            [&](uint64_t _index, mt19937_64& _rng) {
+                lock_guard<mutex> guard(lock);
+                locked.erase(_index);
+                locked.insert(string(24, static_cast<char>(_rng())));
+            });
+
+        cout << "  " << readers << " readers: seqlock " << static_cast<uint64_t>(optimistic)
+             << ", mutex " << static_cast<uint64_t>(mutexed) << endl;
+    }
+}
+
+// _threads threads each run _ops rounds of _per_round operations on
+// random ranks; returns total operations per second.
+template <typename Round>
+double mixed_throughput(unsigned _threads, size_t _ops, unsigned _per_round, Round _round)
+{
+    vector<thread> threads;
+    time_point<steady_clock> start = steady_clock::now();
+
+    for (unsigned t = 0; t < _threads; t++)
+    {
+        threads.emplace_back([&, t]() {
+            mt19937_64 rng(200 + t);
+
+            for (size_t i = 0; i < _ops; i++)
+                _round(rng);
+        });
+    }
+    for (thread& t : threads)
+        t.join();
+    return (double(_per_round) * _threads * _ops / duration_cast<duration<double> >(steady_clock::now() - start).count());
+}
+
+// olc_btree against concurrent_storage (one writer at a time, seqlocked
+// readers) and one mutex around storage: mixed erase/insert/get, then
+// erase + insert alone, which both trees serialize, then reads under one
+// busy writer, where the per-node versions should pay off.
+void bench_btree(size_t _size, size_t _ops)
+{
+    mt19937_64 rng(11);
+    vector<string> keys = random_strings(_size, 24, rng);
+    unsigned cores = max(1u, thread::hardware_concurrency());
+    size_t per_thread = max<size_t>(_ops / cores, 1);
+
+    cout << "btree: " << _size << " strings, ops/s" << endl;
+    for (unsigned threads = 1; threads <= cores; threads *= 2)
+    {
+        olc_btree tree;
+        concurrent_storage shared;
+        storage locked;
+        mutex lock;
+
+        for (const string& key : keys)
+        {
+            tree.insert(key);
+            shared.insert(key);
+            locked.insert(key);
+        }
+
+        double olc = mixed_throughput(threads, per_thread, 3, [&](mt19937_64& _rng) {
+            tree.erase(_rng() % _size);
+            tree.insert(string(24, static_cast<char>(_rng())));
+            tree.get(_rng() % _size);
+        });
+        double seqlock = mixed_throughput(threads, per_thread, 3, [&](mt19937_64& _rng) {
+            shared.erase(_rng() % _size);
+            shared.insert(string(24, static_cast<char>(_rng())));
+            shared.get(_rng() % _size);
+        });
+        double mutexed = mixed_throughput(threads, per_thread, 3, [&](mt19937_64& _rng) {
+            lock_guard<mutex> guard(lock);
+
+            locked.erase(_rng() % _size);
+            locked.insert(string(24, static_cast<char>(_rng())));
+            locked.get(_rng() % _size);
+        });
+
+        double olc_writes = mixed_throughput(threads, per_thread, 2, [&](mt19937_64& _rng) {
+            tree.erase(_rng() % _size);
+            tree.insert(string(24, static_cast<char>(_rng())));
+        });
+        double seqlock_writes = mixed_throughput(threads, per_thread, 2, [&](mt19937_64& _rng) {
+            shared.erase(_rng() % _size);
+            shared.insert(string(24, static_cast<char>(_rng())));
+        });
+        double mutexed_writes = mixed_throughput(threads, per_thread, 2, [&](mt19937_64& _rng) {
+            lock_guard<mutex> guard(lock);
+
+            locked.erase(_rng() % _size);
+            locked.insert(string(24, static_cast<char>(_rng())));
+        });
+
+        cout << "  " << threads << " threads, erase + insert + get: olc " << static_cast<uint64_t>(olc)
+             << ", seqlock " << static_cast<uint64_t>(seqlock)
+             << ", mutex " << static_cast<uint64_t>(mutexed) << endl;
+        cout << "  " << threads << " threads, erase + insert: olc " << static_cast<uint64_t>(olc_writes)
+             << ", seqlock " << static_cast<uint64_t>(seqlock_writes)
+             << ", mutex " << static_cast<uint64_t>(mutexed_writes) << endl;
+        // reads/s next to one writer, as in bench_concurrent
+        double olc_reads = read_throughput(threads, _size, milliseconds(500),
+            [&](uint64_t _index) { return (tree.get(_index)); },
+            [&](uint64_t _index, mt19937_64& _rng) {
+                tree.erase(_index);
+                tree.insert(string(24, static_cast<char>(_rng())));
+            });
+        double seqlock_reads = read_throughput(threads, _size, milliseconds(500),
+            [&](uint64_t _index) { return (shared.get(_index)); },
+            [&](uint64_t _index, mt19937_64& _rng) {
+                shared.erase(_index);
+                shared.insert(string(24, static_cast<char>(_rng())));
+            });
+
+        cout << "  " << threads << " readers, 1 writer: olc " << static_cast<uint64_t>(olc_reads)
+             << ", seqlock " << static_cast<uint64_t>(seqlock_reads) << " reads/s" << endl;
+    }
+}
+
+// Erase + insert pairs on plain storage against logged_storage at a few
+// group commit intervals; interval 0 syncs every record.
+void bench_wal(size_t _size, size_t _ops)
+{
+    mt19937_64 rng(5);
+    vector<string> keys = random_strings(_size, 24, rng);
+    string prefix = "bench_wal." + to_string(::getpid());
+    storage plain;
+
+    for (const string& key : keys)
+        plain.insert(key);
+
+    steady_clock::time_point start = steady_clock::now();
+
+    for (size_t i = 0; i < _ops; i++)
+    {
+        plain.erase(rng() % _size);
+        plain.insert(string(24, static_cast<char>(rng())));
+    }
+
+    double base = ns_per_op(steady_clock::now() - start, _ops);
+
+    cout << "wal: " << _size << " strings, erase + insert, ns/op" << endl;
+    cout << "  in memory: " << base << endl;
+    for (long interval : {0L, 2000L, 10000L})
+    {
+        // every record waits for the disk without grouping
+        size_t ops = interval == 0 ? min<size_t>(_ops, 1000) : _ops;
+        double logged;
+
+        {
+            logged_storage durable(prefix, microseconds(interval));
+
+            for (const string& key : keys)
+                durable.insert(key);
+            durable.checkpoint();
+            start = steady_clock::now();
+            for (size_t i = 0; i < ops; i++)
+            {
+                durable.erase(rng() % _size);
+                durable.insert(string(24, static_cast<char>(rng())));
+            }
+            durable.sync();
+            logged = ns_per_op(steady_clock::now() - start, ops);
+        }
+        ::unlink((prefix + ".ckpt").c_str());
+        ::unlink((prefix + ".wal").c_str());
+        cout << "  group commit " << interval << " us: " << logged
+             << " (" << showpos << (logged - base) * 100 / base << noshowpos << "%)" << endl;
+    }
+}
+
+// Time to a first lookup after a restart: storage::load rebuilds the
+// tree from a checkpoint, mapped_storage only maps its file.
+void bench_mapped(size_t _size)
+{
+    mt19937_64 rng(8);
+    vector<string> keys = random_strings(_size, 24, rng);
+    string prefix = "bench_mapped." + to_string(::getpid());
+
+    {
+        storage plain;
+        mapped_storage mapped(prefix + ".map");
+
+        for (const string& key : keys)
+        {
+            plain.insert(key);
+            mapped.insert(key);
+        }
+        plain.save(prefix + ".ckpt");
+    }
+
+    steady_clock::time_point start = steady_clock::now();
+    storage loaded;
+
+    loaded.load(prefix + ".ckpt");
+    loaded.get(_size / 2);
+
+    double load_ms = duration_cast<duration<double, milli> >(steady_clock::now() - start).count();
+
+    start = steady_clock::now();
+
+    double map_ms;
+
+    {
+        mapped_storage reopened(prefix + ".map");
+
+        reopened.get(_size / 2);
+        map_ms = duration_cast<duration<double, milli> >(steady_clock::now() - start).count();
+    }
+    ::unlink((prefix + ".ckpt").c_str());
+    ::unlink((prefix + ".map").c_str());
+    cout << "mapped: " << _size << " strings, reopen to first get, ms" << endl;
+    cout << "  storage::load " << load_ms << ", mapped_storage " << map_ms << endl;
+}
+
+// Random inserts of short and page-sized keys and erases, growing the
+// file and then draining it again, on the smallest pool and reopened
+// every round, checked against a sorted vector.
+void check_paged(const string& _path, size_t _ops)
+{
+    mt19937_64 rng(17);
+    vector<string> model;
+    uint64_t pages = 0;
+
+    for (int round = 0; round < 4; round++)
+    {
+        paged_storage paged(_path, paged_storage::min_budget);
+        // inserts outnumber erases 3:1 while growing, 1:3 while draining
+        uint64_t insert_share = round % 2 == 0 ? 3 : 1;
+
+        for (size_t i = 0; i < _ops; i++)
+        {
+            if (model.empty() || rng() % 4 < insert_share)
+            {
+                size_t length = rng() % 8 == 0 ? paged_storage::max_key : rng() % 32;
+                string key(length, 'a');
+
+                for (char& c : key)
+                    c = static_cast<char>('a' + rng() % 4);
+                paged.insert(key);
+                model.insert(upper_bound(model.begin(), model.end(), key), key);
+            }
+            else
+            {
+                uint64_t index = rng() % model.size();
+
+                paged.erase(index);
+                model.erase(model.begin() + index);
+            }
+        }
+        if (paged.size() != model.size())
+            throw runtime_error("paged model check: size differs");
+        for (uint64_t i = 0; i < model.size(); i++)
+        {
+            if (paged.get(i) != model[i])
+                throw runtime_error("paged model check: string " + to_string(i) + " differs");
+        }
+        pages = max(pages, paged.page_count());
+    }
+    ::unlink(_path.c_str());
+    cout << "  model check: " << 4 * _ops << " ops, at most " << pages << " pages, ok" << endl;
+}
+
+// Random gets and erase + insert pairs on a paged_storage whose pool
+// holds an eighth of its pages, with page reads per operation.
+void bench_paged(size_t _size, size_t _ops)
+{
+    mt19937_64 rng(6);
+    vector<string> keys = random_strings(_size, 24, rng);
+    string path = "bench_paged." + to_string(::getpid());
+    // 24 byte keys take 26 bytes in a leaf
+    size_t budget = max<size_t>(_size * 26 / 8, paged_storage::min_budget);
+    paged_storage paged(path, budget);
+
+    for (const string& key : keys)
+        paged.insert(key);
+    paged.flush();
+
+    uint64_t reads = paged.page_reads();
+    steady_clock::time_point start = steady_clock::now();
+
+    for (size_t i = 0; i < _ops; i++)
+        paged.get(rng() % _size);
+
+    double get_ns = ns_per_op(steady_clock::now() - start, _ops);
+    double get_reads = static_cast<double>(paged.page_reads() - reads) / _ops;
+
+    reads = paged.page_reads();
+    start = steady_clock::now();
+    for (size_t i = 0; i < _ops; i++)
+    {
+        paged.erase(rng() % _size);
+        paged.insert(string(24, static_cast<char>(rng())));
+    }
+
+    double update_ns = ns_per_op(steady_clock::now() - start, _ops);
+    double update_reads = static_cast<double>(paged.page_reads() - reads) / _ops;
+
+    ::unlink(path.c_str());
+    cout << "paged: " << _size << " strings, pool of " << budget / paged_storage::page_size << " pages" << endl;
+    cout << "  get " << get_ns << " ns, " << get_reads << " page reads" << endl;
+    cout << "  erase + insert " << update_ns << " ns, " << update_reads << " page reads" << endl;
+    check_paged(path, _ops);
+}
+
+// Random and in-order gets on the tree and on the frozen array, and
+// what freezing and thawing cost.
+void bench_freeze(size_t _size, size_t _ops)
+{
+    mt19937_64 rng(13);
+    vector<string> keys = random_strings(_size, 24, rng);
+    vector<uint64_t> indices(_ops);
+    storage st;
+    size_t checksum = 0;
+
+    for (const string& key : keys)
+        st.insert(key);
+    for (uint64_t& index : indices)
+        index = rng() % _size;
+
+    cout << "freeze: " << _size << " strings, ns/op" << endl;
+    for (int frozen = 0; frozen < 2; frozen++)
+    {
+        steady_clock::time_point start = steady_clock::now();
+
+        if (frozen)
+            st.freeze();
+
+        double freeze_ms = duration_cast<duration<double, milli> >(steady_clock::now() - start).count();
+
+        start = steady_clock::now();
+        for (uint64_t index : indices)
+            checksum += st.get(index).size();
+
+        double random_ns = ns_per_op(steady_clock::now() - start, _ops);
+
+        start = steady_clock::now();
+        for (uint64_t i = 0; i < _size; i++)
+            checksum += st.get(i).size();
+
+        double scan_ns = ns_per_op(steady_clock::now() - start, _size);
+
+        cout << "  " << (frozen ? "frozen" : "tree") << ": random get " << random_ns
+             << ", in-order get " << scan_ns;
+        if (frozen)
+            cout << ", freeze " << freeze_ms << " ms";
+        cout << endl;
+    }
+
+    steady_clock::time_point start = steady_clock::now();
+
+    st.thaw();
+    cout << "  thaw " << duration_cast<duration<double, milli> >(steady_clock::now() - start).count()
+         << " ms (" << checksum % 10 << ")" << endl;
+}
+
+// Mixed erase/insert/get on sharded_storage against one mutex around
+// storage, then erasing most of it again so underfull shards merge.
+void bench_sharded(size_t _size, size_t _ops)
+{
+    mt19937_64 rng(17);
+    vector<string> keys = random_strings(_size, 24, rng);
+    unsigned cores = max(1u, thread::hardware_concurrency());
+    size_t per_thread = max<size_t>(_ops / cores, 1);
+    size_t max_shard = max<size_t>(_size / 256, 64);
+
+    cout << "sharded: " << _size << " strings, at most " << max_shard
+         << " per shard, erase + insert + get, ops/s" << endl;
+    for (unsigned threads = 1; threads <= cores; threads *= 2)
+    {
+        sharded_storage sharded(max_shard);
+        storage locked;
+        mutex lock;
+
+        for (const string& key : keys)
+        {
+            sharded.insert(key);
+            locked.insert(key);
+        }
+
+        double split = mixed_throughput(threads, per_thread, 3, [&](mt19937_64& _rng) {
+            sharded.erase(_rng() % _size);
+            sharded.insert(string(24, static_cast<char>(_rng())));
+            sharded.get(_rng() % _size);
+        });
+        double mutexed = mixed_throughput(threads, per_thread, 3, [&](mt19937_64& _rng) {
+            lock_guard<mutex> guard(lock);
+
+            locked.erase(_rng() % _size);
+            locked.insert(string(24, static_cast<char>(_rng())));
+            locked.get(_rng() % _size);
+        });
+
+        cout << "  " << threads << " threads: sharded " << static_cast<uint64_t>(split)
+             << " (" << sharded.shard_count() << " shards), mutex " << static_cast<uint64_t>(mutexed) << endl;
+    }
+
+    sharded_storage sharded(max_shard);
+    size_t checksum = 0;
+
+    for (const string& key : keys)
+        sharded.insert(key);
+
+    size_t before = sharded.shard_count();
+    steady_clock::time_point start = steady_clock::now();
+
+    while (sharded.size() > _size / 8)
+        sharded.erase(rng() % sharded.size());
+
+    double erase_ns = ns_per_op(steady_clock::now() - start, _size - sharded.size());
+
+    for (uint64_t i = 0; i < sharded.size(); i += 97)
+        checksum += sharded.get(i).size();
+    cout << "  erase 7/8: " << erase_ns << " ns/op, shards " << before << " -> " << sharded.shard_count()
+         << " (" << checksum % 10 << ")" << endl;
+}
+
+// Updates, snapshots and gets on PersistentTree against storage, which
+// has to copy its strings out for a view that later updates leave alone.
+void bench_persistent(size_t _size, size_t _ops)
+{
+    mt19937_64 rng(19);
+    vector<string> keys = random_strings(_size, 24, rng);
+    PersistentTree<string> persistent;
+    storage st;
+    size_t checksum = 0;
+
+    for (const string& key : keys)
+    {
+        persistent.insert(key);
+        st.insert(key);
+    }
+
+    steady_clock::time_point start = steady_clock::now();
+
+    for (size_t i = 0; i < _ops; i++)
+    {
+        st.erase(rng() % _size);
+        st.insert(string(24, static_cast<char>(rng())));
+    }
+
+    double storage_ns = ns_per_op(steady_clock::now() - start, _ops);
+
+    start = steady_clock::now();
+    for (size_t i = 0; i < _ops; i++)
+    {
+        persistent.deleteByIndex(rng() % _size);
+        persistent.insert(string(24, static_cast<char>(rng())));
+    }
+
+    double persistent_ns = ns_per_op(steady_clock::now() - start, _ops);
+
+    // a live snapshot keeps the old path alive, so updates free nothing
+    PersistentTree<string>::Snapshot held;
+
+    start = steady_clock::now();
+    for (size_t i = 0; i < _ops; i++)
+    {
+        if (i % 64 == 0)
+            held = persistent.snapshot();
+        persistent.deleteByIndex(rng() % _size);
+        persistent.insert(string(24, static_cast<char>(rng())));
+    }
+
+    double held_ns = ns_per_op(steady_clock::now() - start, _ops);
+
+    start = steady_clock::now();
+    for (size_t i = 0; i < _ops; i++)
+        checksum += persistent.snapshot().size();
+
+    double snapshot_ns = ns_per_op(steady_clock::now() - start, _ops);
+
+    start = steady_clock::now();
+
+    vector<string> copy;
+
+    copy.reserve(st.size());
+    for (uint64_t i = 0; i < st.size(); i++)
+        copy.push_back(st.get(i));
+
+    double copy_ms = duration_cast<duration<double, milli> >(steady_clock::now() - start).count();
+
+    start = steady_clock::now();
+    for (size_t i = 0; i < _ops; i++)
+        checksum += st.get(rng() % _size).size();
+
+    double storage_get_ns = ns_per_op(steady_clock::now() - start, _ops);
+
+    start = steady_clock::now();
+    for (size_t i = 0; i < _ops; i++)
+        checksum += held.find(rng() % _size)->size();
+
+    double snapshot_get_ns = ns_per_op(steady_clock::now() - start, _ops);
+
+    cout << "persistent: " << _size << " strings, ns/op" << endl;
+    cout << "  erase + insert: storage " << storage_ns << ", persistent " << persistent_ns
+         << ", persistent with a snapshot every 64 updates " << held_ns << endl;
+    cout << "  snapshot: storage copy " << copy_ms << " ms, persistent " << snapshot_ns << " ns" << endl;
+    cout << "  get: storage " << storage_get_ns << ", snapshot " << snapshot_get_ns
+         << " (" << (checksum + copy.size()) % 10 << ")" << endl;
+}
+
+// bench [all|prefetch|concurrent|btree|wal|mapped|paged|freeze|sharded|persistent] [size] [ops]
+int main(int argc, char** argv)
+{
+    string which = argc > 1 ? argv[1] : "all";
+    size_t size = argc > 2 ? strtoull(argv[2], nullptr, 10) : 1 << 22;
+    size_t ops = argc > 3 ? strtoull(argv[3], nullptr, 10) : 1 << 20;
+
+    if (which == "all" || which == "prefetch")
+        bench_prefetch(size, ops);
+    if (which == "all" || which == "concurrent")
+        bench_concurrent(size);
+    if (which == "all" || which == "btree")
+        bench_btree(size, ops);
+    if (which == "all" || which == "wal")
+        bench_wal(size, ops);
+    if (which == "all" || which == "mapped")
+        bench_mapped(size);
+    if (which == "all" || which == "paged")
+        bench_paged(size, ops);
+    if (which == "all" || which == "freeze")
+        bench_freeze(size, ops);
+    if (which == "all" || which == "sharded")
+        bench_sharded(size, ops);
+    if (which == "all" || which == "persistent")
+        bench_persistent(size, ops);
+    return 0;
+}
@@ -0,0 +1,432 @@
+#ifndef BTREE_HPP
+# define BTREE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <utility>
+#include "epoch.hpp"
+
+// Order-statistic B+tree with optimistic lock coupling.
+//
+// Every node carries a version that is odd while a writer holds it.
+// Readers take no latches: they note a node's version, read what they
+// need, and check that the version did not move before going on to the
+// child, restarting from the root if it did. Writers latch top-down,
+// holding a parent only until the child is latched, and split full
+// nodes on the way down so a split never has to go back up.
+//
+// Inner nodes keep the number of keys under each child, so a rank is
+// found by reading one node per level and get validates against the
+// same counts the writers keep. The price is that every insert and
+// erase changes the root's counts under the root latch, so writers are
+// serialized there much as concurrent_storage serializes them on its
+// mutex; below the root they overlap only for the rest of a descent.
+// What the latches buy is on the read side: a reader restarts only when
+// a node on its own path changed, not on every write to the tree, so
+// reads keep going under a steady stream of writes.
+//
+// Nodes are never merged, so none is freed before the tree; empty
+// leaves are skipped through their zero count. Keys live in immutable
+// heap strings, published by pointer and freed through the epoch domain
+// once erased.
+class olc_btree
+{
+public:
+    olc_btree() : _root(new leaf()) {}
+
+    ~olc_btree()
+    {
+        destroy(_root.load());
+    }
+
+    olc_btree(const olc_btree&) = delete;
+    olc_btree& operator=(const olc_btree&) = delete;
+
+    // equal keys go after the ones already present
+    void insert(string _str)
+    {
+        const string* key = new string(move(_str));
+        node* current = lock_root();
+
+        if (is_full(current))
+            current = grow(current);
+        while (!current->_leaf)
+        {
+            inner* parent = static_cast<inner*>(current);
+            size_t i = parent->route(*key);
+            node* child = parent->_children[i].load(memory_order_relaxed);
+
+            lock(child);
+            if (is_full(child))
+            {
+                split_child(parent, i, child);
+                if (!(*key < *parent->_separators[i].load(memory_order_relaxed)))
+                {
+                    unlock(child);
+                    child = parent->_children[++i].load(memory_order_relaxed);
+                    lock(child);
+                }
+            }
+            parent->add_size(i, 1);
+            unlock(parent);
+            current = child;
+        }
+        static_cast<leaf*>(current)->insert(key);
+        unlock(current);
+    }
+
+    void erase(uint64_t _index)
+    {
+        node* current = lock_root();
+
+        if (_index >= total(current))
+        {
+            unlock(current);
+            return ;
+        }
+        while (!current->_leaf)
+        {
+            inner* parent = static_cast<inner*>(current);
+            size_t i = parent->locate(_index);
+            node* child = parent->_children[i].load(memory_order_relaxed);
+
+            lock(child);
+            parent->add_size(i, -1);
+            unlock(parent);
+            current = child;
+        }
+
+        const string* key = static_cast<leaf*>(current)->erase(_index);
+
+        unlock(current);
+        epoch_domain::instance().retire(const_cast<string*>(key), &dispose_key);
+    }
+
+    // the string at _index, or an empty one past the end
+    string get(uint64_t _index)
+    {
+        epoch_guard guard;
+
+        for (;;)
+        {
+            const string* key = nullptr;
+
+            if (find(_index, key))
+                return (key ? *key : string());
+        }
+    }
+
+    uint64_t size()
+    {
+        for (;;)
+        {
+            node* root = _root.load(memory_order_acquire);
+            uint64_t version = stable_version(root);
+            uint64_t count = total(root);
+
+            if (validate(root, version) && _root.load(memory_order_acquire) == root)
+                return (count);
+        }
+    }
+
+private:
+    static const size_t fanout = 64;
+
+    struct node
+    {
+        // odd while latched; every unlatch moves it on
+        atomic<uint64_t> _version;
+        const bool _leaf;
+        atomic<uint32_t> _n;
+
+        explicit node(bool _is_leaf) : _version(0), _leaf(_is_leaf), _n(0) {}
+    };
+
+    struct leaf : node
+    {
+        atomic<const string*> _keys[fanout];
+
+        leaf() : node(true) {}
+
+        void insert(const string* _key)
+        {
+            uint32_t n = _n.load(memory_order_relaxed);
+            uint32_t at = n;
+
+            while (at > 0 && *_key < *_keys[at - 1].load(memory_order_relaxed))
+            {
+                _keys[at].store(_keys[at - 1].load(memory_order_relaxed), memory_order_relaxed);
+                at--;
+            }
+            _keys[at].store(_key, memory_order_relaxed);
+            _n.store(n + 1, memory_order_relaxed);
+        }
+
+        const string* erase(uint64_t _index)
+        {
+            uint32_t n = _n.load(memory_order_relaxed);
+            const string* key = _keys[_index].load(memory_order_relaxed);
+
+            for (uint32_t i = _index; i + 1 < n; i++)
+                _keys[i].store(_keys[i + 1].load(memory_order_relaxed), memory_order_relaxed);
+            _n.store(n - 1, memory_order_relaxed);
+            return (key);
+        }
+    };
+
+    struct inner : node
+    {
+        atomic<node*> _children[fanout];
+        atomic<uint64_t> _sizes[fanout];
+        // _separators[i] is the smallest key child i + 1 takes; owned here
+        atomic<const string*> _separators[fanout - 1];
+
+        inner() : node(false) {}
+
+        // child an inserted key goes to, after any equal keys
+        size_t route(const string& _key) const
+        {
+            uint32_t n = _n.load(memory_order_relaxed);
+            size_t i = 0;
+
+            while (i + 1 < n && !(_key < *_separators[i].load(memory_order_relaxed)))
+                i++;
+            return (i);
+        }
+
+        // child holding rank _index, which becomes the rank inside it
+        size_t locate(uint64_t& _index) const
+        {
+            uint32_t n = _n.load(memory_order_relaxed);
+            size_t i = 0;
+
+            for (; i + 1 < n; i++)
+            {
+                uint64_t size = _sizes[i].load(memory_order_relaxed);
+
+                if (_index < size)
+                    break;
+                _index -= size;
+            }
+            return (i);
+        }
+
+        void add_size(size_t _i, int64_t _delta)
+        {
+            _sizes[_i].store(_sizes[_i].load(memory_order_relaxed) + _delta, memory_order_relaxed);
+        }
+    };
+
+    atomic<node*> _root;
+
+    static bool is_full(node* _node)
+    {
+        return (_node->_n.load(memory_order_relaxed) == fanout);
+    }
+
+    static uint64_t total(node* _node)
+    {
+        uint32_t n = _node->_n.load(memory_order_relaxed);
+        uint64_t count = 0;
+
+        if (_node->_leaf)
+            return (n);
+        for (uint32_t i = 0; i < n; i++)
+            count += static_cast<inner*>(_node)->_sizes[i].load(memory_order_relaxed);
+        return (count);
+    }
+
+    static uint64_t stable_version(node* _node)
+    {
+        uint64_t version;
+
+        while ((version = _node->_version.load(memory_order_acquire)) & 1)
+            this_thread::yield();
+        return (version);
+    }
+
+    static bool validate(node* _node, uint64_t _version)
+    {
+        atomic_thread_fence(memory_order_acquire);
+        return (_node->_version.load(memory_order_relaxed) == _version);
+    }
+
+    static void lock(node* _node)
+    {
+        for (;;)
+        {
+            uint64_t version = stable_version(_node);
+
+            if (_node->_version.compare_exchange_weak(version, version + 1, memory_order_acquire))
+            {
+                // keeps the node's stores from showing before the odd
+                // version does: a reader that sees one of them and then
+                // validates is sure to see the version moved
+                atomic_thread_fence(memory_order_release);
+                return ;
+            }
+        }
+    }
+
+    static void unlock(node* _node)
+    {
+        _node->_version.fetch_add(1, memory_order_release);
+    }
+
+    node* lock_root()
+    {
+        for (;;)
+        {
+            node* root = _root.load(memory_order_acquire);
+
+            lock(root);
+            if (_root.load(memory_order_acquire) == root)
+                return (root);
+            unlock(root);
+        }
+    }
+
+    // Puts a new root above the latched, full _root, splits the old one
+    // under it and returns the new root, latched. The old root is
+    // unlatched.
+    node* grow(node* _root_node)
+    {
+        inner* root = new inner();
+
+        lock(root);
+        root->_children[0].store(_root_node, memory_order_relaxed);
+        root->_sizes[0].store(total(_root_node), memory_order_relaxed);
+        root->_n.store(1, memory_order_relaxed);
+        split_child(root, 0, _root_node);
+        _root.store(root, memory_order_release);
+        unlock(_root_node);
+        return (root);
+    }
+
+    // Moves the upper half of the latched, full _child of the latched
+    // _parent into a new sibling at _i + 1. _parent has room, since
+    // full nodes are split before anyone descends into them.
+    static void split_child(inner* _parent, size_t _i, node* _child)
+    {
+        node* sibling;
+        const string* separator;
+        uint64_t moved = 0;
+        uint32_t half = fanout / 2;
+
+        if (_child->_leaf)
+        {
+            leaf* from = static_cast<leaf*>(_child);
+            leaf* to = new leaf();
+
+            for (uint32_t j = half; j < fanout; j++)
+                to->_keys[j - half].store(from->_keys[j].load(memory_order_relaxed), memory_order_relaxed);
+            to->_n.store(fanout - half, memory_order_relaxed);
+            from->_n.store(half, memory_order_relaxed);
+            moved = fanout - half;
+            separator = new string(*to->_keys[0].load(memory_order_relaxed));
+            sibling = to;
+        }
+        else
+        {
+            inner* from = static_cast<inner*>(_child);
+            inner* to = new inner();
+
+            for (uint32_t j = half; j < fanout; j++)
+            {
+                uint64_t size = from->_sizes[j].load(memory_order_relaxed);
+
+                to->_children[j - half].store(from->_children[j].load(memory_order_relaxed), memory_order_relaxed);
+                to->_sizes[j - half].store(size, memory_order_relaxed);
+                moved += size;
+            }
+            for (uint32_t j = half; j + 1 < fanout; j++)
+                to->_separators[j - half].store(from->_separators[j].load(memory_order_relaxed), memory_order_relaxed);
+            separator = from->_separators[half - 1].load(memory_order_relaxed);
+            to->_n.store(fanout - half, memory_order_relaxed);
+            from->_n.store(half, memory_order_relaxed);
+            sibling = to;
+        }
+
+        uint32_t n = _parent->_n.load(memory_order_relaxed);
+
+        for (uint32_t j = n; j > _i + 1; j--)
+        {
+            _parent->_children[j].store(_parent->_children[j - 1].load(memory_order_relaxed), memory_order_relaxed);
+            _parent->_sizes[j].store(_parent->_sizes[j - 1].load(memory_order_relaxed), memory_order_relaxed);
+            _parent->_separators[j - 1].store(_parent->_separators[j - 2].load(memory_order_relaxed), memory_order_relaxed);
+        }
+        _parent->_children[_i + 1].store(sibling, memory_order_relaxed);
+        _parent->_sizes[_i + 1].store(moved, memory_order_relaxed);
+        _parent->_separators[_i].store(separator, memory_order_relaxed);
+        _parent->add_size(_i, -static_cast<int64_t>(moved));
+        _parent->_n.store(n + 1, memory_order_relaxed);
+    }
+
+    // One optimistic descent. Returns false if a writer got in the way;
+    // _key is left nullptr when _index is past the end.
+    bool find(uint64_t _index, const string*& _key)
+    {
+        node* current = _root.load(memory_order_acquire);
+        uint64_t version = stable_version(current);
+
+        if (_root.load(memory_order_acquire) != current)
+            return (false);
+        if (_index >= total(current))
+            return (validate(current, version));
+        while (!current->_leaf)
+        {
+            inner* parent = static_cast<inner*>(current);
+            size_t i = parent->locate(_index);
+            node* child = parent->_children[i].load(memory_order_relaxed);
+
+            if (!validate(parent, version))
+                return (false);
+
+            uint64_t child_version = stable_version(child);
+
+            if (!validate(parent, version))
+                return (false);
+            current = child;
+            version = child_version;
+        }
+
+        leaf* at = static_cast<leaf*>(current);
+
+        if (_index >= at->_n.load(memory_order_relaxed))
+            return (false);
+        _key = at->_keys[_index].load(memory_order_relaxed);
+        return (validate(at, version));
+    }
+
+    static void destroy(node* _node)
+    {
+        uint32_t n = _node->_n.load(memory_order_relaxed);
+
+        if (_node->_leaf)
+        {
+            leaf* at = static_cast<leaf*>(_node);
+
+            for (uint32_t i = 0; i < n; i++)
+                delete at->_keys[i].load(memory_order_relaxed);
+            delete at;
+            return ;
+        }
+
+        inner* in = static_cast<inner*>(_node);
+
+        for (uint32_t i = 0; i < n; i++)
+            destroy(in->_children[i].load(memory_order_relaxed));
+        for (uint32_t i = 0; i + 1 < n; i++)
+            delete in->_separators[i].load(memory_order_relaxed);
+        delete in;
+    }
+
+    static void dispose_key(void* _key)
+    {
+        delete static_cast<string*>(_key);
+    }
+};
+
+#endif
@@ -0,0 +1,787 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <list>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <random>
+#include <unistd.h>
+#include "map.hpp"
+#include "storage.hpp"
+
+using namespace std;
+
+// Model checks: every structure is driven by random operations next to a
+// plain standard container doing the same, and compared with it after
+// each batch. A mismatch throws with what differed.
+
+void expect(bool _ok, const string& _what)
+{
+    if (!_ok)
+        throw runtime_error(_what);
+}
+
+typedef ft::map<int, string> ft_map;
+typedef map<int, string> std_map;
+
+// Single-pass view of a vector, for the input iterator path of the range
+// constructor and insert.
+template <class T>
+class input_view
+{
+public:
+    typedef input_iterator_tag iterator_category;
+    typedef T value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const T* pointer;
+    typedef const T& reference;
+
+    input_view(const vector<T>& _values, size_t _at) : _values(&_values), _at(_at) {}
+
+    const T& operator*() const
+    {
+        return ((*_values)[_at]);
+    }
+
+    input_view& operator++()
+    {
+        _at++;
+        return (*this);
+    }
+
+    bool operator==(const input_view& _other) const
+    {
+        return (_at == _other._at);
+    }
+
+    bool operator!=(const input_view& _other) const
+    {
+        return (_at != _other._at);
+    }
+
+private:
+    const vector<T>* _values;
+    size_t _at;
+};
+
+// Contents, order both ways, ranks and iterator arithmetic against the
+// model.
+void compare_map(ft_map& _map, const std_map& _model, const string& _where)
+{
+    expect(_map.size() == _model.size(), _where + ": size");
+
+    ft_map::iterator it = _map.begin();
+    size_t rank = 0;
+
+    for (std_map::const_iterator m = _model.begin(); m != _model.end(); ++m, ++it, ++rank)
+    {
+        expect(it != _map.end(), _where + ": ends early");
+        expect(it->first == m->first && it->second == m->second, _where + ": entry " + to_string(rank));
+        expect(_map.findByIndex(rank) == it, _where + ": findByIndex " + to_string(rank));
+        expect(it.index() == rank && _map.begin() + rank == it, _where + ": rank of " + to_string(rank));
+    }
+    expect(it == _map.end(), _where + ": ends late");
+
+    std_map::const_reverse_iterator m = _model.rbegin();
+
+    for (ft_map::iterator back = _map.end(); back != _map.begin(); ++m)
+    {
+        --back;
+        expect(back->first == m->first, _where + ": backwards");
+    }
+}
+
+// Random inserts (plain, hinted, emplaced, through operator[]), erases
+// (by key, iterator, range and rank) and lookups.
+void check_map_ops(size_t _ops, mt19937_64& _rng)
+{
+    ft_map tree;
+    std_map model;
+    int keys = static_cast<int>(_ops / 4 + 16);
+
+    for (size_t i = 0; i < _ops; i++)
+    {
+        int key = static_cast<int>(_rng() % keys);
+        string value = to_string(_rng() % 1000);
+        unsigned op = _rng() % 12;
+
+        if (op == 0)
+        {
+            bool added = tree.insert(ft::make_pair(key, value)).second;
+
+            expect(added == model.insert(make_pair(key, value)).second, "insert");
+        }
+        else if (op == 1)
+        {
+            // hints that are right, wrong and at either end
+            ft_map::iterator hint[] = { tree.begin(), tree.end(), tree.lower_bound(key), tree.upper_bound(key) };
+            ft_map::iterator at = tree.insert(hint[_rng() % 4], ft::make_pair(key, value));
+
+            model.insert(make_pair(key, value));
+            expect(at->first == key && at->second == model[key], "hinted insert");
+        }
+        else if (op == 2)
+        {
+            bool added = tree.emplace(key, value).second;
+
+            expect(added == model.emplace(key, value).second, "emplace");
+        }
+        else if (op == 3)
+        {
+            tree[key] += value;
+            model[key] += value;
+        }
+        else if (op == 4)
+            expect(tree.erase(key) == model.erase(key), "erase by key");
+        else if (op == 5 && !model.empty())
+        {
+            size_t rank = _rng() % model.size();
+            std_map::iterator m = model.begin();
+
+            advance(m, rank);
+            model.erase(m);
+            tree.erase(tree.findByIndex(rank));
+        }
+        else if (op == 6 && !model.empty())
+        {
+            size_t first = _rng() % model.size();
+            size_t last = min(model.size(), first + _rng() % 8);
+            std_map::iterator m_first = model.begin();
+            std_map::iterator m_last;
+
+            advance(m_first, first);
+            m_last = m_first;
+            advance(m_last, last - first);
+            model.erase(m_first, m_last);
+            tree.erase(tree.begin() + first, tree.begin() + last);
+        }
+        else if (op == 7)
+        {
+            size_t rank = _rng() % (model.size() + 1);
+            size_t erased = 0;
+
+            if (rank < model.size())
+            {
+                std_map::iterator m = model.begin();
+
+                advance(m, rank);
+                model.erase(m);
+                erased = 1;
+            }
+            expect(tree.eraseByIndex(rank) == erased, "eraseByIndex");
+        }
+        else if (op == 8)
+        {
+            ft_map::iterator lower = tree.lower_bound(key);
+            ft_map::iterator upper = tree.upper_bound(key);
+            std_map::iterator m_lower = model.lower_bound(key);
+            std_map::iterator m_upper = model.upper_bound(key);
+
+            expect((lower == tree.end()) == (m_lower == model.end()), "lower_bound end");
+            expect(lower == tree.end() || lower->first == m_lower->first, "lower_bound");
+            expect((upper == tree.end()) == (m_upper == model.end()), "upper_bound end");
+            expect(upper == tree.end() || upper->first == m_upper->first, "upper_bound");
+            expect(tree.index_of(key) == static_cast<size_t>(distance(model.begin(), m_lower)), "index_of");
+            expect(tree.count(key) == model.count(key), "count");
+            expect((tree.find(key) == tree.end()) == (model.find(key) == model.end()), "find");
+        }
+        else if (op == 9)
+        {
+            int hi = key + static_cast<int>(_rng() % 64);
+
+            expect(tree.count_range(key, hi) == static_cast<size_t>(distance(model.lower_bound(key), model.lower_bound(hi))),
+                "count_range");
+        }
+        else if (op == 10)
+        {
+            bool threw = false;
+
+            try
+            {
+                expect(tree.at(key) == model.at(key), "at");
+            }
+            catch (out_of_range&)
+            {
+                threw = true;
+            }
+            expect(threw == (model.count(key) == 0), "at on a missing key");
+        }
+        else if (op == 11 && !model.empty())
+        {
+            // iterator arithmetic between random ranks
+            size_t a = _rng() % model.size();
+            size_t b = _rng() % (model.size() + 1);
+            ft_map::iterator it = tree.begin() + a;
+            ft_map::iterator end_it = tree.end();
+
+            expect((tree.begin() + b) - it == static_cast<ptrdiff_t>(b) - static_cast<ptrdiff_t>(a), "iterator difference");
+            expect((end_it - (model.size() - a)) == it, "iterator from end");
+            expect((a < b) == (it < tree.begin() + b), "iterator order");
+            it += static_cast<ptrdiff_t>(b) - static_cast<ptrdiff_t>(a);
+            expect(it == tree.begin() + b, "iterator +=");
+            if (b < model.size())
+                expect(tree.begin()[b].first == it->first, "iterator []");
+        }
+        if (i % 4096 == 0)
+            compare_map(tree, model, "map ops step " + to_string(i));
+    }
+    compare_map(tree, model, "map ops");
+}
+
+// Range construction and insert from sorted random-access, sorted and
+// unsorted forward, and single-pass input, and sorted input with
+// duplicates, which must keep the first of each key.
+void check_map_ranges(size_t _size, mt19937_64& _rng)
+{
+    vector<ft::pair<int, string> > sorted;
+    vector<ft::pair<int, string> > shuffled;
+
+    for (size_t i = 0; i < _size; i++)
+        sorted.push_back(ft::make_pair(static_cast<int>(i * 3), to_string(i)));
+    for (size_t i = 0; i < _size; i++)
+        shuffled.push_back(ft::make_pair(static_cast<int>(_rng() % (_size + 1)), to_string(i)));
+
+    // sorted, but with the duplicates the shuffled keys have
+    vector<ft::pair<int, string> > repeated;
+
+    for (size_t i = 0; i < _size; i++)
+        repeated.push_back(ft::make_pair(static_cast<int>(i / 3), to_string(i)));
+
+    list<ft::pair<int, string> > sorted_list(sorted.begin(), sorted.end());
+    list<ft::pair<int, string> > shuffled_list(shuffled.begin(), shuffled.end());
+    std_map from_sorted;
+    std_map from_shuffled;
+
+    for (size_t i = 0; i < _size; i++)
+    {
+        from_sorted.insert(make_pair(sorted[i].first, sorted[i].second));
+        from_shuffled.insert(make_pair(shuffled[i].first, shuffled[i].second));
+    }
+
+    ft_map a(sorted.begin(), sorted.end());
+    ft_map b(sorted_list.begin(), sorted_list.end());
+    ft_map c(shuffled_list.begin(), shuffled_list.end());
+    ft_map d(input_view<ft::pair<int, string> >(shuffled, 0), input_view<ft::pair<int, string> >(shuffled, _size));
+    ft_map e(input_view<ft::pair<int, string> >(sorted, 0), input_view<ft::pair<int, string> >(sorted, _size));
+    ft_map f;
+    ft_map g(repeated.begin(), repeated.end());
+    std_map from_repeated;
+
+    for (size_t i = 0; i < _size; i++)
+        from_repeated.insert(make_pair(repeated[i].first, repeated[i].second));
+    compare_map(g, from_repeated, "sorted range with duplicates");
+
+    compare_map(a, from_sorted, "sorted vector range");
+    compare_map(b, from_sorted, "sorted list range");
+    compare_map(c, from_shuffled, "unsorted list range");
+    compare_map(d, from_shuffled, "unsorted input range");
+    compare_map(e, from_sorted, "sorted input range");
+    f.insert(shuffled.begin(), shuffled.end());
+    compare_map(f, from_shuffled, "insert range");
+}
+
+// Copies, parallel clones, swap and teardown of a map big enough to hand
+// subtrees to clone threads.
+void check_map_copies(size_t _size, mt19937_64& _rng)
+{
+    ft_map tree;
+    std_map model;
+
+    for (size_t i = 0; i < _size; i++)
+    {
+        int key = static_cast<int>(_rng());
+
+        tree[key] = to_string(i);
+        model[key] = to_string(i);
+    }
+
+    ft_map copied(tree);
+    ft_map assigned;
+    ft_map cloned;
+    ft_map swapped;
+
+    assigned[1] = "replaced";
+    assigned = tree;
+    cloned[2] = "replaced";
+    cloned.copy_from(tree, 4);
+    compare_map(copied, model, "copy");
+    compare_map(assigned, model, "assignment");
+    compare_map(cloned, model, "parallel clone");
+    expect(cloned == tree, "operator== on a clone");
+    swapped.swap(cloned);
+    compare_map(swapped, model, "swap");
+    expect(cloned.empty(), "swap left the other map");
+    copied.clear();
+    expect(copied.empty() && copied.begin() == copied.end(), "clear");
+    compare_map(tree, model, "original after copies");
+}
+
+void check_map(size_t _ops)
+{
+    mt19937_64 rng(1);
+
+    check_map_ops(_ops, rng);
+    check_map_ranges(_ops / 16 + 3, rng);
+    check_map_ranges(7, rng);
+    check_map_ranges(0, rng);
+    check_map_copies(max<size_t>(_ops / 2, 1 << 17), rng);
+
+    ft::map<string, string> by_string;
+    map<string, string> model;
+
+    for (size_t i = 0; i < _ops / 4; i++)
+    {
+        string key = to_string(rng() % 1000);
+
+        by_string[key] += "x";
+        model[key] += "x";
+    }
+    expect(by_string.size() == model.size(), "string keys: size");
+    for (map<string, string>::iterator m = model.begin(); m != model.end(); ++m)
+        expect(by_string.at(m->first) == m->second, "string keys: " + m->first);
+    cout << "map: " << _ops << " ops, ok" << endl;
+}
+
+typedef RedBlackTree<string> string_tree;
+
+// Short strings over four letters, so equal strings are common.
+string random_key(mt19937_64& _rng)
+{
+    string key(_rng() % 7, 'a');
+
+    for (char& c : key)
+        c = static_cast<char>('a' + _rng() % 4);
+    return (key);
+}
+
+void model_insert(vector<string>& _model, const string& _key)
+{
+    _model.insert(upper_bound(_model.begin(), _model.end(), _key), _key);
+}
+
+// Black height of the subtree under _node, the leaves counting as one,
+// once its colors, counts and parent links are checked.
+size_t check_subtree(string_tree& _tree, string_tree::NodePtr _node, const string& _where)
+{
+    string_tree::NodePtr nil = _tree.getNull();
+
+    if (_node == nil)
+        return (1);
+
+    size_t left = check_subtree(_tree, _node->left, _where);
+    size_t right = check_subtree(_tree, _node->right, _where);
+
+    expect(left == right, _where + ": black heights differ");
+    expect(_node->color == BLACK || (_node->left->color == BLACK && _node->right->color == BLACK),
+        _where + ": red node with a red child");
+    expect(_node->count == _node->left->count + _node->right->count + 1, _where + ": count");
+    expect(_node->left == nil || _node->left->parent == _node, _where + ": parent link");
+    expect(_node->right == nil || _node->right->parent == _node, _where + ": parent link");
+    return (left + (_node->color == BLACK));
+}
+
+// Red-black invariants, then the keys in order against the model.
+void compare_tree(string_tree& _tree, const vector<string>& _model, const string& _where)
+{
+    string_tree::NodePtr root = _tree.getRoot();
+
+    expect(root == _tree.getNull() || (root->color == BLACK && root->parent == _tree.getNull()), _where + ": root");
+    check_subtree(_tree, root, _where);
+    expect(_tree.size() == _model.size(), _where + ": size");
+
+    string_tree::NodePtr node = _tree.find(0);
+
+    for (size_t i = 0; i < _model.size(); i++, node = _tree.successor(node))
+        expect(node->data == _model[i], _where + ": key " + to_string(i));
+}
+
+void fill_tree(string_tree& _tree, vector<string>& _model, size_t _count, mt19937_64& _rng)
+{
+    for (size_t i = 0; i < _count; i++)
+    {
+        string key = random_key(_rng);
+
+        _tree.insert(key);
+        model_insert(_model, key);
+    }
+}
+
+// Split, join, union and erase of rank windows on whole trees, plus
+// the descents that share work between ranks: findNear and findSorted.
+void check_tree_ops(size_t _rounds, mt19937_64& _rng)
+{
+    string_tree tree;
+    vector<string> model;
+
+    fill_tree(tree, model, 512, _rng);
+    for (size_t round = 0; round < _rounds; round++)
+    {
+        string where = "tree round " + to_string(round);
+        size_t n = model.size();
+        unsigned op = _rng() % 6;
+
+        if (op == 0)
+        {
+            // split at a rank, then join back around a pivot
+            size_t rank = _rng() % (n + 1);
+            string_tree right;
+            string_tree joined;
+            vector<string> left_model(model.begin(), model.begin() + rank);
+            vector<string> right_model(model.begin() + rank, model.end());
+            string pivot = rank < n ? model[rank] : (n > 0 ? model.back() : string("b"));
+
+            tree.splitAtRank(rank, right);
+            compare_tree(tree, left_model, where + " split left");
+            compare_tree(right, right_model, where + " split right");
+            joined.join(tree, pivot, right);
+            model_insert(model, pivot);
+            expect(tree.size() == 0 && right.size() == 0, where + ": join left its inputs");
+            compare_tree(joined, model, where + " join");
+            tree.merge(joined);
+        }
+        else if (op == 1)
+        {
+            // split at a key, then merge the halves back
+            string key = random_key(_rng);
+            size_t rank = lower_bound(model.begin(), model.end(), key) - model.begin();
+            string_tree right;
+
+            tree.splitAtKey(key, right);
+            compare_tree(tree, vector<string>(model.begin(), model.begin() + rank), where + " split at key left");
+            compare_tree(right, vector<string>(model.begin() + rank, model.end()), where + " split at key right");
+            if (_rng() % 2)
+                tree.merge(right);
+            else
+            {
+                right.merge(tree);
+                tree.merge(right);
+            }
+        }
+        else if (op == 2)
+        {
+            // union with a tree from a handful of keys up to a bigger one
+            string_tree other;
+            vector<string> other_model;
+
+            fill_tree(other, other_model, _rng() % 2 ? _rng() % 8 : _rng() % (2 * n + 2), _rng);
+            tree.merge(other);
+            expect(other.size() == 0, where + ": merge left its input");
+            model.insert(model.end(), other_model.begin(), other_model.end());
+            sort(model.begin(), model.end());
+        }
+        else if (op == 3)
+        {
+            // past the end and empty windows included
+            size_t first = _rng() % (n + 2);
+            size_t last = first + _rng() % (n / 4 + 2);
+
+            tree.eraseRange(first, last);
+            if (first < n)
+                model.erase(model.begin() + first, model.begin() + min(last, n));
+        }
+        else if (op == 4 && n > 0)
+        {
+            size_t rank = _rng() % n;
+            string_tree::NodePtr node = tree.find(rank);
+
+            for (int hop = 0; hop < 32; hop++)
+            {
+                ptrdiff_t delta = static_cast<ptrdiff_t>(_rng() % (2 * n + 4)) - static_cast<ptrdiff_t>(n + 2);
+
+                if (_rng() % 2)
+                    delta /= 64;
+
+                ptrdiff_t target = static_cast<ptrdiff_t>(rank) + delta;
+                string_tree::NodePtr near = tree.findNear(node, delta);
+
+                if (target < 0 || target >= static_cast<ptrdiff_t>(n))
+                    expect(near == tree.getNull(), where + ": findNear past an end");
+                else
+                {
+                    expect(near != tree.getNull() && near->data == model[target], where + ": findNear");
+                    node = near;
+                    rank = target;
+                }
+            }
+        }
+        else if (op == 5)
+        {
+            vector<size_t> ranks(_rng() % 64);
+            vector<string_tree::NodePtr> nodes(ranks.size());
+
+            for (size_t& rank : ranks)
+                rank = _rng() % (n + 3);
+            sort(ranks.begin(), ranks.end());
+            tree.findSorted(ranks.begin(), ranks.end(), nodes.data());
+            for (size_t i = 0; i < ranks.size(); i++)
+            {
+                expect(ranks[i] < n ? nodes[i]->data == model[ranks[i]] : nodes[i] == tree.getNull(),
+                    where + ": findSorted");
+            }
+        }
+        // keep the tree from draining or growing without bound
+        if (model.size() < 64)
+            fill_tree(tree, model, 256, _rng);
+        if (model.size() > 2048)
+            tree.eraseRange(0, model.size() - 1024), model.erase(model.begin(), model.end() - 1024);
+        compare_tree(tree, model, where);
+    }
+}
+
+// Contents in order and at random ranks, and past the end.
+void compare_storage(storage& _st, const vector<string>& _model, mt19937_64& _rng, const string& _where)
+{
+    expect(_st.size() == _model.size(), _where + ": size");
+    for (size_t i = 0; i < _model.size(); i++)
+        expect(_st.get(i) == _model[i], _where + ": string " + to_string(i));
+    for (size_t i = 0; i < 64 && !_model.empty(); i++)
+    {
+        size_t rank = _rng() % _model.size();
+
+        expect(_st.get(rank) == _model[rank], _where + ": string " + to_string(rank));
+    }
+    expect(_st.get(_model.size()).empty(), _where + ": past the end");
+}
+
+void compare_get_many(storage& _st, const vector<string>& _model, size_t _count, mt19937_64& _rng, const string& _where)
+{
+    vector<uint64_t> indices(_count);
+
+    for (uint64_t& index : indices)
+        index = _rng() % (_model.size() + 2);
+    for (unsigned threads = 1; threads <= 4; threads *= 4)
+    {
+        vector<const string*> got = _st.get_many(indices, threads);
+
+        for (size_t i = 0; i < indices.size(); i++)
+        {
+            expect(indices[i] < _model.size() ? got[i] != nullptr && *got[i] == _model[indices[i]] : got[i] == nullptr,
+                _where + ": get_many on " + to_string(threads) + " threads");
+        }
+    }
+}
+
+// storage's operations against a sorted vector: single and batched
+// updates, nearby and batched reads, rank queries, the whole-tree
+// operations, freezing and checkpoints.
+void check_storage_ops(size_t _ops, mt19937_64& _rng)
+{
+    storage st;
+    vector<string> model;
+    string path = "check_storage." + to_string(::getpid());
+    uint64_t near = 0;
+
+    for (size_t i = 0; i < _ops; i++)
+    {
+        string where = "storage op " + to_string(i);
+        size_t n = model.size();
+        unsigned op = _rng() % 16;
+
+        if (op < 3 || n == 0)
+        {
+            string key = random_key(_rng);
+
+            if (op == 0)
+                st.insert(key);
+            else if (op == 1)
+                st.insert(string(key));
+            else
+                st.emplace(key.begin(), key.end());
+            model_insert(model, key);
+        }
+        else if (op < 5)
+        {
+            uint64_t index = _rng() % (n + 2);
+
+            st.erase(index);
+            if (index < n)
+                model.erase(model.begin() + index);
+        }
+        else if (op == 5)
+        {
+            // a walk over nearby ranks, as the finger serves them
+            for (int step = 0; step < 16; step++)
+            {
+                near = (near + n + static_cast<uint64_t>(_rng() % 9) - 4) % n;
+                expect(st.get(near) == model[near], where + ": nearby get");
+            }
+        }
+        else if (op == 6)
+        {
+            vector<pair<uint64_t, string> > batch(_rng() % 48);
+
+            for (pair<uint64_t, string>& entry : batch)
+                entry = make_pair(_rng() % (n + batch.size() / 2 + 2), random_key(_rng));
+            st.apply_batch(batch);
+            for (const pair<uint64_t, string>& entry : batch)
+            {
+                if (entry.first < model.size())
+                    model.erase(model.begin() + entry.first);
+                model_insert(model, entry.second);
+            }
+        }
+        else if (op == 7)
+        {
+            size_t first = _rng() % (n + 2);
+            size_t last = first + _rng() % 16;
+
+            st.erase_range(first, last);
+            if (first < n)
+                model.erase(model.begin() + first, model.begin() + min(last, n));
+        }
+        else if (op == 8)
+        {
+            string lo = random_key(_rng);
+            string hi = random_key(_rng);
+            uint64_t lo_rank = lower_bound(model.begin(), model.end(), lo) - model.begin();
+            uint64_t hi_rank = lower_bound(model.begin(), model.end(), hi) - model.begin();
+
+            expect(st.count_less(lo) == lo_rank && st.index_of(lo) == lo_rank, where + ": count_less");
+            expect(st.count_range(lo, hi) == (lo < hi ? hi_rank - lo_rank : 0), where + ": count_range");
+        }
+        else if (op == 9)
+            compare_get_many(st, model, _rng() % 128, _rng, where);
+        else if (op == 10)
+        {
+            storage right;
+            storage joined;
+            size_t rank = _rng() % (n + 1);
+            string pivot = rank < n ? model[rank] : model.back();
+
+            st.split_at_rank(rank, right);
+            expect(st.size() == rank && right.size() == n - rank, where + ": split_at_rank");
+            joined.join(st, pivot, right);
+            st.merge(joined);
+            model_insert(model, pivot);
+        }
+        else if (op == 11)
+        {
+            storage right;
+            string key = random_key(_rng);
+
+            st.split_at_key(key, right);
+            expect(st.size() == static_cast<uint64_t>(lower_bound(model.begin(), model.end(), key) - model.begin()),
+                where + ": split_at_key");
+            right.merge(st);
+            st.merge(right);
+        }
+        else if (op == 12)
+        {
+            storage other;
+
+            for (size_t j = _rng() % 32; j > 0; j--)
+            {
+                string key = random_key(_rng);
+
+                other.insert(key);
+                model_insert(model, key);
+            }
+            st.merge(other);
+        }
+        else if (op == 13)
+        {
+            // frozen reads, then a write that thaws it again
+            st.freeze();
+            expect(st.frozen(), where + ": freeze");
+            compare_get_many(st, model, 64, _rng, where + " frozen");
+            expect(st.count_less(model[n / 2]) == static_cast<uint64_t>(lower_bound(model.begin(), model.end(), model[n / 2]) - model.begin()),
+                where + ": frozen count_less");
+            if (_rng() % 2)
+                st.thaw();
+            else
+            {
+                st.insert(model[0]);
+                model_insert(model, model[0]);
+            }
+            expect(!st.frozen(), where + ": thaw");
+        }
+        else if (op == 14 && i % 64 == 0)
+        {
+            // checkpoint round trip, frozen or not, then a corrupt file and a
+            // missing one
+            storage loaded;
+
+            if (_rng() % 2)
+                st.freeze();
+            st.save(path);
+            loaded.insert("left alone");
+            loaded.load(path);
+            compare_storage(loaded, model, _rng, where + " loaded");
+
+            FILE* file = fopen(path.c_str(), "r+b");
+
+            fseek(file, 20, SEEK_SET);
+            fputc('~', file);
+            fclose(file);
+
+            for (int missing = 0; missing < 2; missing++)
+            {
+                bool threw = false;
+
+                try
+                {
+                    loaded.load(missing ? path + ".missing" : path);
+                }
+                catch (runtime_error&)
+                {
+                    threw = true;
+                }
+                expect(threw, where + (missing ? ": missing checkpoint accepted" : ": corrupt checkpoint accepted"));
+                compare_storage(loaded, model, _rng, where + " after a failed load");
+            }
+        }
+        // the same bounds as the tree's
+        if (model.size() > 2048)
+            st.erase_range(0, model.size() - 1024), model.erase(model.begin(), model.end() - 1024);
+        if (i % 1024 == 0)
+            compare_storage(st, model, _rng, where);
+    }
+    ::unlink(path.c_str());
+    compare_storage(st, model, _rng, "storage ops");
+    // large enough for get_many to split across threads
+    while (model.size() < 20000)
+    {
+        string key = random_key(_rng) + random_key(_rng);
+
+        st.insert(key);
+        model_insert(model, key);
+    }
+    compare_get_many(st, model, 20000, _rng, "large get_many");
+}
+
+void check_storage(size_t _ops)
+{
+    mt19937_64 rng(2);
+
+    // a round or a batch does far more than a map operation, so these
+    // get a share of the budget rather than all of it
+    check_tree_ops(_ops / 64 + 1, rng);
+    check_storage_ops(_ops / 4 + 1, rng);
+    cout << "storage: " << _ops << " ops, ok" << endl;
+}
+
+// check [all|map|storage] [ops]
+int main(int argc, char** argv)
+{
+    string which = argc > 1 ? argv[1] : "all";
+    size_t ops = argc > 2 ? strtoull(argv[2], nullptr, 10) : 1 << 16;
+
+    try
+    {
+        if (which == "all" || which == "map")
+            check_map(ops);
+        if (which == "all" || which == "storage")
+            check_storage(ops);
+    }
+    catch (exception& e)
+    {
+        cout << "FAILED: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
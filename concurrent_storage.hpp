@@ -0,0 +1,218 @@
+#ifndef CONCURRENT_STORAGE_HPP
+# define CONCURRENT_STORAGE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "epoch.hpp"
+#include "rbtc.hpp"
+
+// the tree below is walked by readers that hold no lock
+template <class T>
+struct concurrent_reads<epoch_allocator<T> > : true_type {};
+
+// storage for many reader threads and one writer at a time.
+//
+// Writers take a mutex and bump a sequence number to odd before touching
+// the tree and back to even afterwards. Readers take no lock: they read
+// the sequence, walk the tree, and keep the result only if the sequence
+// is the same even value afterwards, else they try again. Nodes are
+// allocated through epoch_allocator and readers walk under epoch_guard,
+// so a walk racing a writer may see stale links but never freed memory.
+//
+// Strings are returned by value: once validated, a node's string is never
+// changed again, but the node may be erased and freed after the read.
+class concurrent_storage
+{
+public:
+    typedef RedBlackTree<string, less<string>, epoch_allocator<string> > tree_type;
+    typedef tree_type::NodePtr node_pointer;
+
+    concurrent_storage() : _seq(0) {}
+
+    concurrent_storage(const concurrent_storage&) = delete;
+    concurrent_storage& operator=(const concurrent_storage&) = delete;
+
+    void insert(const string& _str)
+    {
+        lock_guard<mutex> lock(_write);
+
+        begin_write();
+        _data.insert(_str);
+        end_write();
+    }
+
+    void insert(string&& _str)
+    {
+        lock_guard<mutex> lock(_write);
+
+        begin_write();
+        _data.insert(move(_str));
+        end_write();
+    }
+
+    void erase(uint64_t _index)
+    {
+        lock_guard<mutex> lock(_write);
+
+        if (_index >= _data.size())
+            return ;
+        begin_write();
+        _data.deleteByIndex(_index);
+        end_write();
+    }
+
+    // the string at _index, or an empty one past the end
+    string get(uint64_t _index)
+    {
+        epoch_guard guard;
+        node_pointer node;
+
+        do
+            node = find(_index, wait_even());
+        while (node == nullptr);
+        return (node == _data.getNull() ? string() : node->data);
+    }
+
+    // Strings at _indices in request order, all from the same version of
+    // the tree; empty strings for indices past the end. Every index is
+    // walked first and the version checked once for all of them, and only
+    // then are the strings copied out.
+    vector<string> get_many(const vector<uint64_t>& _indices)
+    {
+        epoch_guard guard;
+        vector<node_pointer> nodes(_indices.size());
+        vector<string> result(_indices.size());
+
+        for (;;)
+        {
+            uint64_t seq = wait_even();
+            size_t i = 0;
+
+            for (; i < _indices.size(); i++)
+            {
+                nodes[i] = walk(_indices[i]);
+                if (nodes[i] == nullptr)
+                    break;
+            }
+            if (i == _indices.size() && validate(seq))
+                break;
+        }
+        for (size_t i = 0; i < _indices.size(); i++)
+        {
+            if (nodes[i] != _data.getNull())
+                result[i] = nodes[i]->data;
+        }
+        return (result);
+    }
+
+    uint64_t size()
+    {
+        epoch_guard guard;
+
+        for (;;)
+        {
+            uint64_t seq = wait_even();
+            uint64_t size = load_relaxed(load_link(*_data.getRootAddress())->count);
+
+            if (validate(seq))
+                return (size);
+        }
+    }
+
+private:
+    // deepest a red-black tree of 2^64 nodes can be
+    static const int max_depth = 128;
+
+    void begin_write()
+    {
+        _seq.store(_seq.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+    }
+
+    void end_write()
+    {
+        _seq.store(_seq.load(memory_order_relaxed) + 1, memory_order_release);
+    }
+
+    uint64_t wait_even()
+    {
+        uint64_t seq;
+
+        while ((seq = _seq.load(memory_order_acquire)) & 1)
+            this_thread::yield();
+        return (seq);
+    }
+
+    bool validate(uint64_t _seq_before)
+    {
+        atomic_thread_fence(memory_order_acquire);
+        return (_seq.load(memory_order_relaxed) == _seq_before);
+    }
+
+    // Links and counts are fields the writer changes under the mutex, and
+    // with concurrent_reads set the tree writes them with atomic release
+    // stores, so readers load them atomically too: each load is whole and
+    // really made, never torn, merged or hoisted out of the retry loop,
+    // and what it sees is only used once validate confirms no writer ran
+    // meanwhile. Links are loaded with acquire, which pairs with the
+    // store that published a new node, so its fields are seen as built.
+    template <class T>
+    static T load_relaxed(const T& _field)
+    {
+        return (__atomic_load_n(&_field, __ATOMIC_RELAXED));
+    }
+
+    static node_pointer load_link(const node_pointer& _link)
+    {
+        return (__atomic_load_n(&_link, __ATOMIC_ACQUIRE));
+    }
+
+    // Rank descent that tolerates a concurrent writer: it gives up after
+    // max_depth steps in case it was led round in circles. The node it
+    // returns is only meaningful if the version is validated afterwards;
+    // nullptr when it gave up.
+    node_pointer walk(uint64_t _index)
+    {
+        node_pointer nil = _data.getNull();
+        node_pointer node = load_link(*_data.getRootAddress());
+
+        for (int depth = 0; node != nil; depth++)
+        {
+            if (depth == max_depth)
+                return (nullptr);
+
+            node_pointer left = load_link(node->left);
+            uint64_t left_count = load_relaxed(left->count);
+
+            if (_index < left_count)
+                node = left;
+            else if (_index == left_count)
+                break;
+            else
+            {
+                _index -= left_count + 1;
+                node = load_link(node->right);
+            }
+        }
+        return (node);
+    }
+
+    // walk, returning nullptr unless the tree was unchanged the whole way
+    node_pointer find(uint64_t _index, uint64_t _seq_before)
+    {
+        node_pointer node = walk(_index);
+
+        return (node != nullptr && validate(_seq_before) ? node : nullptr);
+    }
+
+    tree_type _data;
+    mutex _write;
+    atomic<uint64_t> _seq;
+};
+
+#endif
@@ -0,0 +1,304 @@
+#ifndef EPOCH_HPP
+# define EPOCH_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Epoch-based reclamation for memory that lock-free readers may still be
+// looking at.
+//
+// A reader announces the global epoch while inside a read section and
+// clears it on the way out: one plain store and one fence, no shared
+// counter. Memory is retired instead of freed, tagged with the global
+// epoch, and kept in a limbo list of the retiring thread. The epoch only
+// moves on once every reader inside a section has announced the current
+// one, so anything retired two epochs ago can no longer be reached.
+class epoch_domain
+{
+public:
+    typedef void (*deleter)(void*);
+
+    // the process-wide domain all epoch_guards and epoch_allocators use
+    static epoch_domain& instance()
+    {
+        static epoch_domain domain;
+        return (domain);
+    }
+
+    ~epoch_domain()
+    {
+        // only static destruction gets here, no reader is left
+        record* rec = _head.load();
+
+        while (rec != nullptr)
+        {
+            record* next = rec->_next;
+
+            for (vector<retired>& list : rec->_limbo)
+                free_all(list);
+            delete rec;
+            rec = next;
+        }
+        free_all(_orphans);
+    }
+
+    void enter()
+    {
+        record* rec = self();
+
+        if (rec->_nesting++ == 0)
+        {
+            rec->_epoch.store(_global.load(), memory_order_relaxed);
+            atomic_thread_fence(memory_order_seq_cst);
+        }
+    }
+
+    void leave()
+    {
+        record* rec = self();
+
+        if (--rec->_nesting == 0)
+            rec->_epoch.store(idle, memory_order_release);
+    }
+
+    // Frees _ptr with _free once no reader can still hold it.
+    void retire(void* _ptr, deleter _free)
+    {
+        record* rec = self();
+        uint64_t epoch = _global.load();
+        vector<retired>& list = rec->_limbo[epoch % 3];
+
+        // a list three epochs old is past the two-epoch grace period
+        if (rec->_limbo_epoch[epoch % 3] != epoch)
+        {
+            free_all(list);
+            rec->_limbo_epoch[epoch % 3] = epoch;
+        }
+        list.push_back(retired(_ptr, _free, epoch));
+        if (++rec->_since_advance >= advance_every)
+        {
+            rec->_since_advance = 0;
+            try_advance();
+        }
+    }
+
+    // Moves the epoch on if every active reader has caught up, then
+    // frees what the calling thread retired long enough ago. Returns
+    // whether the epoch moved.
+    bool try_advance()
+    {
+        uint64_t epoch = _global.load();
+
+        atomic_thread_fence(memory_order_seq_cst);
+        for (record* rec = _head.load(); rec != nullptr; rec = rec->_next)
+        {
+            uint64_t seen = rec->_epoch.load(memory_order_acquire);
+
+            if (seen != idle && seen != epoch)
+                return (false);
+        }
+        if (!_global.compare_exchange_strong(epoch, epoch + 1))
+            return (false);
+        collect(self(), epoch + 1);
+        return (true);
+    }
+
+private:
+    struct retired
+    {
+        void* _ptr;
+        deleter _free;
+        uint64_t _epoch;
+
+        retired(void* _p, deleter _f, uint64_t _e) : _ptr(_p), _free(_f), _epoch(_e) {}
+    };
+
+    // One per thread, reused after the thread exits, freed with the
+    // domain. The list is only ever pushed to, so walking it is safe.
+    struct record
+    {
+        atomic<uint64_t> _epoch;
+        atomic<bool> _used;
+        record* _next;
+        size_t _nesting;
+        size_t _since_advance;
+        vector<retired> _limbo[3];
+        uint64_t _limbo_epoch[3];
+
+        record() : _epoch(idle), _used(true), _next(nullptr), _nesting(0), _since_advance(0)
+        {
+            for (uint64_t& e : _limbo_epoch)
+                e = 0;
+        }
+    };
+
+    // Returns the thread's record to the pool when the thread ends and
+    // hands whatever it still has in limbo to the domain.
+    struct owner
+    {
+        record* _rec;
+
+        owner() : _rec(nullptr) {}
+
+        ~owner()
+        {
+            if (_rec == nullptr)
+                return ;
+            epoch_domain& domain = instance();
+            lock_guard<mutex> lock(domain._orphans_lock);
+
+            for (vector<retired>& list : _rec->_limbo)
+            {
+                domain._orphans.insert(domain._orphans.end(), list.begin(), list.end());
+                list.clear();
+            }
+            _rec->_used.store(false, memory_order_release);
+        }
+    };
+
+    static const uint64_t idle = 0;
+    static const size_t advance_every = 64;
+
+    atomic<uint64_t> _global;
+    atomic<record*> _head;
+    mutex _orphans_lock;
+    vector<retired> _orphans;
+
+    epoch_domain() : _global(1), _head(nullptr) {}
+
+    record* self()
+    {
+        static thread_local owner mine;
+
+        if (mine._rec == nullptr)
+            mine._rec = acquire();
+        return (mine._rec);
+    }
+
+    record* acquire()
+    {
+        for (record* rec = _head.load(); rec != nullptr; rec = rec->_next)
+        {
+            bool used = false;
+
+            if (!rec->_used.load(memory_order_relaxed)
+                && rec->_used.compare_exchange_strong(used, true))
+                return (rec);
+        }
+
+        record* rec = new record();
+
+        rec->_next = _head.load();
+        while (!_head.compare_exchange_weak(rec->_next, rec))
+            ;
+        return (rec);
+    }
+
+    // frees what _rec and the exited threads retired before _epoch - 1
+    void collect(record* _rec, uint64_t _epoch)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            if (_rec->_limbo_epoch[i] + 2 <= _epoch)
+                free_all(_rec->_limbo[i]);
+        }
+
+        unique_lock<mutex> lock(_orphans_lock, try_to_lock);
+
+        if (!lock.owns_lock())
+            return ;
+
+        vector<retired>::iterator keep = _orphans.begin();
+
+        for (retired& item : _orphans)
+        {
+            if (item._epoch + 2 <= _epoch)
+                item._free(item._ptr);
+            else
+                *keep++ = item;
+        }
+        _orphans.erase(keep, _orphans.end());
+    }
+
+    static void free_all(vector<retired>& _list)
+    {
+        for (retired& item : _list)
+            item._free(item._ptr);
+        _list.clear();
+    }
+};
+
+// Marks a read section for as long as it lives; nests.
+class epoch_guard
+{
+public:
+    epoch_guard()
+    {
+        epoch_domain::instance().enter();
+    }
+
+    ~epoch_guard()
+    {
+        epoch_domain::instance().leave();
+    }
+
+    epoch_guard(const epoch_guard&) = delete;
+    epoch_guard& operator=(const epoch_guard&) = delete;
+};
+
+// std::allocator whose frees go through the epoch domain: destroy is
+// put off together with deallocate, so an object stays intact until no
+// reader can reach it. Give it to a container that readers walk under
+// epoch_guard.
+template <class T>
+class epoch_allocator : public allocator<T>
+{
+public:
+    template <class U>
+    struct rebind
+    {
+        typedef epoch_allocator<U> other;
+    };
+
+    epoch_allocator() {}
+
+    template <class U>
+    epoch_allocator(const epoch_allocator<U>&) {}
+
+    template <class U>
+    void destroy(U*) {}
+
+    void deallocate(T* _ptr, size_t)
+    {
+        epoch_domain::instance().retire(_ptr, &dispose);
+    }
+
+private:
+    static void dispose(void* _ptr)
+    {
+        T* ptr = static_cast<T*>(_ptr);
+
+        ptr->~T();
+        allocator<T>().deallocate(ptr, 1);
+    }
+};
+
+template <class T, class U>
+bool operator==(const epoch_allocator<T>&, const epoch_allocator<U>&)
+{
+    return (true);
+}
+
+template <class T, class U>
+bool operator!=(const epoch_allocator<T>&, const epoch_allocator<U>&)
+{
+    return (false);
+}
+
+#endif
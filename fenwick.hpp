@@ -0,0 +1,99 @@
+#ifndef FENWICK_HPP
+# define FENWICK_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+// Binary indexed tree over a row of counters: adding to one counter and
+// summing a prefix are O(log n), and find descends the implicit tree to
+// the counter holding a given unit instead of binary searching over
+// prefix sums. Count may be an atomic integer; every access then goes
+// through it, but a find racing with adds only sees some interleaving of
+// them, so callers have to revalidate what it returns.
+template <class Count = uint64_t>
+class fenwick
+{
+public:
+    explicit fenwick(size_t _size = 0) : _tree(_size + 1) {}
+
+    fenwick(const fenwick&) = delete;
+    fenwick& operator=(const fenwick&) = delete;
+
+    size_t size() const
+    {
+        return (_tree.size() - 1);
+    }
+
+    // Sets the counters to _counts in O(n) instead of n adds.
+    void assign(const vector<uint64_t>& _counts)
+    {
+        for (size_t i = 1; i < _tree.size(); i++)
+            _tree[i] = 0;
+        for (size_t i = 1; i < _tree.size() && i <= _counts.size(); i++)
+        {
+            uint64_t value = _tree[i] + _counts[i - 1];
+            size_t up = i + (i & -i);
+
+            _tree[i] = value;
+            if (up < _tree.size())
+                _tree[up] += value;
+        }
+    }
+
+    // _delta is added modulo 2^64, so -1 takes one away
+    void add(size_t _index, uint64_t _delta)
+    {
+        for (size_t i = _index + 1; i < _tree.size(); i += i & -i)
+            _tree[i] += _delta;
+    }
+
+    // sum of the counters before _index
+    uint64_t prefix(size_t _index) const
+    {
+        uint64_t sum = 0;
+
+        for (size_t i = _index; i > 0; i -= i & -i)
+            sum += _tree[i];
+        return (sum);
+    }
+
+    uint64_t total() const
+    {
+        return (prefix(size()));
+    }
+
+    // The counter holding unit _unit, counting from 0 across all of them,
+    // with _unit turned into its offset inside that counter; size() once
+    // _unit is past the total.
+    size_t find(uint64_t& _unit) const
+    {
+        size_t at = 0;
+        size_t step = 1;
+
+        while (step * 2 < _tree.size())
+            step *= 2;
+        for (; step > 0; step /= 2)
+        {
+            if (at + step < _tree.size())
+            {
+                uint64_t count = _tree[at + step];
+
+                if (count <= _unit)
+                {
+                    at += step;
+                    _unit -= count;
+                }
+            }
+        }
+        return (at);
+    }
+
+private:
+    // 1-based: _tree[i] sums the i & -i counters ending at i - 1
+    vector<Count> _tree;
+};
+
+#endif
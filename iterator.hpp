@@ -2,6 +2,9 @@
 # define FT_ITERATOR_HPP
 
 #include <iostream>
+#include <limits>
+#include <type_traits>
+#include <utility>
 #include "map"
 
 namespace ft
@@ -114,6 +117,9 @@ class pair
 
 	pair (const first_type &a, const second_type &b) : first(a), second(b) {};
 
+	template<class U, class V>
+	pair (U &&a, V &&b) : first(std::forward<U>(a)), second(std::forward<V>(b)) {};
+
 	// pair & operator=(const pair & pr)
 	// {
 	// 	this->first = pr.first;
@@ -163,7 +169,7 @@ bool operator>=(const pair<A, B> & lhs, const pair<A, B> & rhs)
 template <class A, class B>
 ft::pair<A, B> make_pair( A t, B u )
 {
-	return (pair<A, B>(t, u));
+	return (pair<A, B>(std::move(t), std::move(u)));
 }
 
 template <typename T>
@@ -448,16 +454,14 @@ template <class T>
 struct Node {
 	typedef Node<T> *node_pointer;
 	
-	Node() : _data(nullptr),
-			_parent(nullptr),
+	Node() : _parent(nullptr),
 			_left(nullptr),
 			_right(nullptr),
-			_is_sentinal(false),
 			_color(0),
+			_is_sentinal(false),
 			_count(0) {};
 
-	Node(T* data, node_pointer parent = nullptr, node_pointer left = nullptr, node_pointer right = nullptr, bool is_sentinal = false, int color = 0, size_t count = 0) : 
-		_data(data),
+	Node(node_pointer parent, node_pointer left = nullptr, node_pointer right = nullptr, bool is_sentinal = false, int color = 0, size_t count = 0) : 
 		_parent(parent),
 		_left(left),
 		_right(right),
@@ -465,8 +469,8 @@ struct Node {
 		_is_sentinal(is_sentinal),
 		_count(count) {};
 
+	// links only, the value is constructed in place by the tree
 	Node(const Node &other) : 
-		_data(other._data),
 		_parent(other._parent),
 		_left(other._left),
 		_right(other._right),
@@ -476,37 +480,45 @@ struct Node {
 
 	~Node() {};
 
+	// the pair lives inside the node, access key with .first and value with .second
+	T &data() { return (*reinterpret_cast<T*>(&_storage)); }
+	const T &data() const { return (*reinterpret_cast<const T*>(&_storage)); }
+
 	public:
-		T* _data; // holds the pair, access key with .first and value with .second
 		node_pointer _parent; // pointer to the parent
 		node_pointer _left; // pointer to left child
 		node_pointer _right; // pointer to right child
 		int _color; // 1 -> Red, 0 -> Black
 		bool _is_sentinal; // 1 -> Red, 0 -> Black
 		size_t _count;
+		// raw storage, never constructed in the sentinal
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type _storage;
 };
 
 template <class T>
-class   map_iterator : public ft::iterator<std::bidirectional_iterator_tag, T>
+class   map_iterator;
+
+template <class T>
+map_iterator<T> operator+(typename map_iterator<T>::difference_type n, const map_iterator<T> &other)
+{
+	return (other + n);
+}
+
+template <class T>
+class   map_iterator : public ft::iterator<std::random_access_iterator_tag, T>
 {
 	public:
 		typedef T iterator_type;
-		typedef typename ft::iterator<std::bidirectional_iterator_tag, T>::iterator_category iterator_category;
-	    typedef typename ft::iterator<std::bidirectional_iterator_tag, T>::value_type value_type;
-	    typedef typename ft::iterator<std::bidirectional_iterator_tag, T>::difference_type difference_type;
-	    typedef typename ft::iterator<std::bidirectional_iterator_tag, T>::pointer pointer;
-	    typedef typename ft::iterator<std::bidirectional_iterator_tag, T>::reference reference;
+		typedef typename ft::iterator<std::random_access_iterator_tag, T>::iterator_category iterator_category;
+	    typedef typename ft::iterator<std::random_access_iterator_tag, T>::value_type value_type;
+	    typedef typename ft::iterator<std::random_access_iterator_tag, T>::difference_type difference_type;
+	    typedef typename ft::iterator<std::random_access_iterator_tag, T>::pointer pointer;
+	    typedef typename ft::iterator<std::random_access_iterator_tag, T>::reference reference;
 		typedef Node<typename std::remove_const<value_type>::type>*	node_pointer;
 
 		map_iterator() : _ptr(nullptr) {};
 		map_iterator(const map_iterator<typename std::remove_const<value_type>::type> &copy) : _ptr(copy._ptr) {}
 		map_iterator(node_pointer node) : _ptr(node) {}
-		
-		map_iterator	&operator=(const map_iterator &other)
-		{
-			this->_ptr = other._ptr;
-			return (*this);
-		}
 
 		~map_iterator() {};
 		
@@ -648,18 +660,113 @@ class   map_iterator : public ft::iterator<std::bidirectional_iterator_tag, T>
 			return tmp;
 		}
 
+		// rank of the element in the map, size() for end(). Climbs to the
+		// root adding the _count of every left subtree passed on the way.
+		size_t index() const
+		{
+			node_pointer node = _ptr;
+			size_t rank;
+
+			if (node->_is_sentinal)
+				return (node->_right->_count);
+			rank = node->_left->_count;
+			while (!node->_parent->_is_sentinal)
+			{
+				if (node == node->_parent->_right)
+					rank += node->_parent->_left->_count + 1;
+				node = node->_parent;
+			}
+			return (rank);
+		}
+
 		bool operator==(const map_iterator& rhs) const { return _ptr == rhs._ptr; }
 	    bool operator!=(const map_iterator& rhs) const { return _ptr != rhs._ptr; }
-	    bool operator<(const map_iterator& rhs) const { return _ptr < rhs._ptr; }
-	    bool operator>(const map_iterator& rhs) const { return _ptr > rhs._ptr; }
-	    bool operator<=(const map_iterator& rhs) const { return _ptr <= rhs._ptr; }
-		bool operator>=(const map_iterator& rhs) const { return _ptr >= rhs._ptr; }
-		reference	operator*(void) const { return (*this->_ptr->_data); }
-		pointer		operator->(void) const { return (this->_ptr->_data); }
+	    bool operator<(const map_iterator& rhs) const { return index() < rhs.index(); }
+	    bool operator>(const map_iterator& rhs) const { return index() > rhs.index(); }
+	    bool operator<=(const map_iterator& rhs) const { return index() <= rhs.index(); }
+		bool operator>=(const map_iterator& rhs) const { return index() >= rhs.index(); }
+		reference	operator*(void) const { return (this->_ptr->data()); }
+		pointer		operator->(void) const { return (&this->_ptr->data()); }
+		reference	operator[](difference_type n) const { return (*(*this + n)); }
+
+	    // arithmetic operators, O(log |n|) through the subtree counts
+		map_iterator operator+(difference_type n) const { return (map_iterator(offset(n))); }
+		map_iterator operator-(difference_type n) const { return (map_iterator(offset(-n))); }
+		difference_type operator-(const map_iterator& rhs) const
+		{
+			return (static_cast<difference_type>(index()) - static_cast<difference_type>(rhs.index()));
+		}
+		map_iterator& operator+=(difference_type n) { _ptr = offset(n); return (*this); }
+		map_iterator& operator-=(difference_type n) { _ptr = offset(-n); return (*this); }
+
 		node_pointer _ptr;
-	    // arithmetic operators
 		private:
 
+			// the sentinal knows the root through its _right link, real
+			// nodes climb to it
+			node_pointer root() const
+			{
+				node_pointer node = _ptr;
+
+				if (node->_is_sentinal)
+					return (node->_right);
+				while (!node->_parent->_is_sentinal)
+					node = node->_parent;
+				return (node);
+			}
+
+			// node holding the given rank, the sentinal for rank == size()
+			node_pointer at_rank(size_t rank) const
+			{
+				return (descend(root(), rank));
+			}
+
+			// node n ranks away. Climbs only until the current subtree
+			// covers the target, then descends, so short hops never
+			// reach the root. Past either end gives the sentinal.
+			node_pointer offset(difference_type n) const
+			{
+				node_pointer node = _ptr;
+
+				if (node->_is_sentinal)
+					return (at_rank(node->_right->_count + n));
+				while (n < -static_cast<difference_type>(node->_left->_count)
+					|| n > static_cast<difference_type>(node->_right->_count))
+				{
+					if (node->_parent->_is_sentinal)
+						return (node->_parent);
+					if (node == node->_parent->_left)
+						n -= static_cast<difference_type>(node->_right->_count) + 1;
+					else
+						n += static_cast<difference_type>(node->_left->_count) + 1;
+					node = node->_parent;
+				}
+				return (descend(node, n + node->_left->_count));
+			}
+
+			// rank-th node of the subtree under node
+			node_pointer descend(node_pointer node, size_t rank) const
+			{
+				size_t left;
+
+				if (node->_is_sentinal)
+					return (node);
+				while (!node->_is_sentinal)
+				{
+					left = node->_left->_count;
+					if (rank < left)
+						node = node->_left;
+					else if (rank == left)
+						break;
+					else
+					{
+						rank -= left + 1;
+						node = node->_right;
+					}
+				}
+				return (node);
+			}
+
 			node_pointer max()
 			{
 				node_pointer temp = _ptr;
@@ -2,6 +2,7 @@
 # define FT_MAP_HPP
 
 #include <iostream>
+#include <iterator>
 #include "iterator.hpp"
 #include "rbt.hpp"
 
@@ -51,6 +52,47 @@ class map
 			allocator_type	_alloc;
 			key_compare		_key_compare;
 
+			// Strictly sorted input into an empty map is built as a
+			// balanced tree in O(n), after a first pass over the source
+			// checks the order. Anything else, and input that can be read
+			// only once, goes in one by one behind an end() hint, which
+			// sorted input passes in O(1) plus the count update on its
+			// path.
+			template< class InputIt >
+			void insert_range( InputIt first, InputIt last )
+			{
+				insert_range(first, last, typename std::iterator_traits<InputIt>::iterator_category());
+			}
+
+			template< class InputIt >
+			void insert_range( InputIt first, InputIt last, std::input_iterator_tag )
+			{
+				for (; first != last; ++first)
+					_rbt.insert_hint(_rbt.get_sentinal(), *first);
+			}
+
+			template< class ForwardIt >
+			void insert_range( ForwardIt first, ForwardIt last, std::forward_iterator_tag )
+			{
+				if (_rbt.size() == 0 && strictly_sorted(first, last))
+					_rbt.build_sorted(first, last);
+				else
+					insert_range(first, last, std::input_iterator_tag());
+			}
+
+			template< class ForwardIt >
+			bool strictly_sorted( ForwardIt first, ForwardIt last ) const
+			{
+				if (first == last)
+					return (true);
+				for (ForwardIt next = first; ++next != last; first = next)
+				{
+					if (!_key_compare((*first).first, (*next).first))
+						return (false);
+				}
+				return (true);
+			}
+
 		//Member Functions
 		//default
 		public:
@@ -65,12 +107,7 @@ class map
 					_alloc(alloc),
 					_key_compare(comp)
 			{
-				while (first != last)
-				{
-					if (_rbt.find_val(_rbt.get_root(), *first) == _rbt.get_sentinal())
-						_rbt.insert(*first);
-					first++;
-				}
+				insert_range(first, last);
 			}
 
 			map( const map& other ) : _rbt(other._rbt),
@@ -83,15 +120,23 @@ class map
             {
                 _alloc = other._alloc;
                 _key_compare = other._key_compare;
-                map &non_const_other = const_cast<map&>(other);
-                clear();
-                for (map::iterator it = non_const_other.begin(); it != non_const_other.end(); it++)
-                {
-                    insert(*it);
-                }
+                _rbt = other._rbt;
                 return (*this);
             } 
 
+			// same as operator=, but big trees are cloned on up to
+			// threads threads
+			map& copy_from( const map& other, unsigned threads )
+			{
+				if (this == &other)
+					return (*this);
+				_alloc = other._alloc;
+				_key_compare = other._key_compare;
+				clear();
+				_rbt.clone_from(other._rbt, threads);
+				return (*this);
+			}
+
 			allocator_type get_allocator() const
 			{
 				return _alloc;
@@ -102,31 +147,33 @@ class map
 			{
 				node_pointer node;
 
-				node = _rbt.find_key(key);
-				if (node->_data->first != key)
+				node = _rbt.find_key(key, _key_compare);
+				if (node->_is_sentinal)
 					throw std::out_of_range("No such key exists");
-				return (node->_data->second);
+				return (node->data().second);
 			};
 
 			const T& at( const Key& key ) const
 			{
 				node_pointer node;
 
-				node = _rbt.find_key(key);
-				if (node->_data->first != key)
+				node = _rbt.find_key(key, _key_compare);
+				if (node->_is_sentinal)
 					throw std::out_of_range("No such key exists");
-				return (node->_data->second);
+				return (node->data().second);
 			};
 
 			T& operator[]( const Key& key )
 			{
 				node_pointer node;
-
-				node = _rbt.find_key(key);
-				if (node->_data->first == key) 
-					return (node->_data->second);
-				else
-					return ((*insert(ft::make_pair(key, mapped_type())).first).second);
+				node_pointer parent;
+				bool is_left;
+
+				// the pair is only built on a miss
+				node = _rbt.find_slot_key(key, _key_compare, parent, is_left);
+				if (node->_is_sentinal)
+					node = _rbt.link_node(_rbt.create_node(key, mapped_type()), parent, is_left);
+				return (node->data().second);
 			};
 			
 			// Iterators
@@ -195,67 +242,58 @@ class map
 
 			ft::pair<iterator, bool> insert( const value_type& value )
             {
-                if (_rbt.find_val(_rbt.get_root(), value) == _rbt.get_sentinal())
-				    return (ft::make_pair(iterator(_rbt.insert(value)), true));
-                else
-                    return (ft::make_pair(iterator(_rbt.find_val(_rbt.get_root(), value)), false));
+                ft::pair<node_pointer, bool> res = _rbt.insert_unique(value);
+
+                return (ft::make_pair(iterator(res.first), res.second));
 			};
 
+			ft::pair<iterator, bool> insert( value_type&& value )
+            {
+                ft::pair<node_pointer, bool> res = _rbt.insert_unique(std::move(value));
+
+                return (ft::make_pair(iterator(res.first), res.second));
+			};
+
+			template< class... Args >
+			ft::pair<iterator, bool> emplace( Args&&... args )
+			{
+				ft::pair<node_pointer, bool> res = _rbt.emplace_unique(std::forward<Args>(args)...);
+
+				return (ft::make_pair(iterator(res.first), res.second));
+			}
+
 			template< class InputIt >
 			void insert( InputIt first, InputIt last, typename ft::enable_if<!std::is_integral<InputIt>::value, InputIt>::type* = nullptr )
             {
-                
-                // _rbt.prettyPrint();
-                for (; first != last; first++)
-                {
-                    // std::cout << "key: " << first->first << " val: " << first->second << std::endl;
-                    if (_rbt.find_val(_rbt.get_root(), *first) == _rbt.get_sentinal())
-                    {
-                        // std::cout << "INSERTING" << std::endl;
-				        _rbt.insert(*first);
-                    }
-
-                }
+                insert_range(first, last);
             }
 
 			iterator insert (iterator position, const value_type& val)
 			{
-				(void)position;
-				if (_rbt.find_val(_rbt.get_root(), val) == _rbt.get_sentinal())
-                {
-				    _rbt.insert(val);
-                }
-				return (iterator(_rbt.find_val(_rbt.get_root(), val)));
+				return (iterator(_rbt.insert_hint(position._ptr, val).first));
 			}
 
 			void erase( iterator pos )
             {
-                iterator first = begin();
-                while (first != end())
-                {
-                    if (first == pos)
-					{
-                        _rbt.deleteNode(pos->first);
-						break;
-					}
-					first++;
-                }
+                _rbt.deleteNodeHelper(pos._ptr);
             }
 
 			void erase( iterator first, iterator last )
             {
+                // deletion relinks nodes instead of moving values, so the
+                // successor stays valid while its predecessor is removed
                 while (first != last)
-                    _rbt.deleteNode((*first++).first);
+                    _rbt.deleteNodeHelper((first++)._ptr);
             }
 
 			size_type erase( const Key& key )
             {
-                if (_rbt.find_key(key) != _rbt.get_sentinal())
-                {
-                    _rbt.deleteNode(key);
-                    return (1);
-                }
-                return (0);
+                node_pointer node = _rbt.find_key(key, _key_compare);
+
+                if (node->_is_sentinal)
+                    return (0);
+                _rbt.deleteNodeHelper(node);
+                return (1);
             }
 
 			size_type eraseByIndex( const size_t index )
@@ -282,7 +320,7 @@ class map
 			{
 				node_pointer node;
 	
-				node = _rbt.find_key(key);
+				node = _rbt.find_key(key, _key_compare);
 				if (!node->_is_sentinal)
 						return (1);
 				return (0);
@@ -292,10 +330,12 @@ class map
 			{
 				node_pointer node;
 	
-				node = _rbt.find_key(key);
+				node = _rbt.find_key(key, _key_compare);
 				return (iterator(node));
 			}
 
+			// rank-aware iterator: walking on from here with ++ or + n
+			// needs no further descents from the root
 			iterator findByIndex( const size_t index )
 			{
 				node_pointer node;
@@ -304,11 +344,16 @@ class map
 				return (iterator(node));
 			}
 
+			const_iterator findByIndex( const size_t index ) const
+			{
+				return (const_iterator(_rbt.findByIndex(_rbt.get_root(), index)));
+			}
+
 			const_iterator find( const Key& key ) const
 			{
 				node_pointer node;
 	
-				node = _rbt.find_key(key);
+				node = _rbt.find_key(key, _key_compare);
 				return (const_iterator(node));
 			}
 
@@ -324,54 +369,41 @@ class map
 
 			iterator lower_bound( const Key& key )
 			{
-				iterator it = begin();
-
-				while (it != end())
-				{
-					if (_key_compare((*it).first, key) == 0)
-						return (it);
-					it++;
-				}
-				return (find(key));
+				return (iterator(_rbt.lower_bound_key(key, _key_compare)));
 			}
 
 			const_iterator lower_bound( const Key& key ) const
 			{
-				const_iterator it = begin();
-
-				while (it != end())
-				{
-					if (_key_compare((*it).first, key) == 0)
-						return (it);
-					it++;
-				}
-				return (find(key));
+				return (const_iterator(_rbt.lower_bound_key(key, _key_compare)));
 			}
 
 			iterator upper_bound( const Key& key )
 			{
-				iterator it = begin();
-
-				while (it != end())
-				{
-					if (_key_compare(key, (*it).first) == 1)
-						return (it);
-					it++;
-				}
-				return (end());
+				return (iterator(_rbt.upper_bound_key(key, _key_compare)));
 			}
 
 			const_iterator upper_bound( const Key& key ) const
 			{
-				const_iterator it = begin();
+				return (const_iterator(_rbt.upper_bound_key(key, _key_compare)));
+			}
 
-				while (it != end())
-				{
-					if (_key_compare(key, (*it).first) == 1)
-						return (it);
-					it++;
-				}
-				return (end());
+			// rank lower_bound(key) has
+			size_type index_of( const Key& key ) const
+			{
+				return (_rbt.count_less_key(key, _key_compare));
+			}
+
+			size_type count_less( const Key& key ) const
+			{
+				return (index_of(key));
+			}
+
+			// number of keys in [lo, hi)
+			size_type count_range( const Key& lo, const Key& hi ) const
+			{
+				if (!_key_compare(lo, hi))
+					return (0);
+				return (index_of(hi) - index_of(lo));
 			}
 
 			key_compare key_comp() const
@@ -402,8 +434,6 @@ class map
 				lb++;
 				rb++;
 			}
-			if (lb->first != rb->first || lb->second != rb->second)
-				return (false);
 			return (true);
 		}
 
@@ -0,0 +1,694 @@
+#ifndef MAPPED_TREE_HPP
+# define MAPPED_TREE_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "storage.hpp"
+
+using namespace std;
+
+// Order-statistic red-black tree living in a memory-mapped file.
+//
+// Nodes and keys are carved out of one file arena and refer to each
+// other by file offset instead of pointer, so the file is the container:
+// opening it maps the arena and reads the header, nothing else, and
+// pages come in from the page cache as lookups touch them. Growing the
+// arena remaps it, which only moves the base address.
+//
+// Keys are appended to the arena next to the nodes and never moved;
+// erased nodes go to a free list for reuse, erased keys stay where they
+// are until compact() rewrites the file with only the live tree. The
+// tree follows RedBlackTree in rbtc.hpp step for step, with a sentinel
+// node in the file for TNULL.
+//
+// The file is only consistent after sync() or the destructor. The
+// header records whether it was, and a file left behind by a crash in
+// between is refused rather than read as a damaged tree.
+class mapped_storage
+{
+public:
+    explicit mapped_storage(const string& _file) :
+        _path(_file), _fd(-1), _base(nullptr), _capacity(0)
+    {
+        struct stat st;
+
+        _fd = ::open(_path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (_fd < 0)
+            throw runtime_error("cannot open " + _path + ": " + strerror(errno));
+        try
+        {
+            if (::fstat(_fd, &st) != 0)
+                throw runtime_error("cannot stat " + _path + ": " + strerror(errno));
+            if (st.st_size == 0)
+                create();
+            else
+                open_existing(st.st_size);
+        }
+        catch (...)
+        {
+            if (_base != nullptr)
+                ::munmap(_base, _capacity);
+            ::close(_fd);
+            throw ;
+        }
+    }
+
+    ~mapped_storage()
+    {
+        try
+        {
+            if (_base != nullptr)
+                sync();
+        }
+        catch (...)
+        {
+        }
+        if (_base != nullptr)
+            ::munmap(_base, _capacity);
+        ::close(_fd);
+    }
+
+    mapped_storage(const mapped_storage&) = delete;
+    mapped_storage& operator=(const mapped_storage&) = delete;
+
+    // equal keys go after the ones already present
+    void insert(const string& _str)
+    {
+        modify();
+
+        offset z = allocate_node(_str);
+        offset y = nil;
+        offset x = head()._root;
+
+        while (x != nil)
+        {
+            y = x;
+            at(x)._count++;
+            x = key_less(z, x) ? at(x)._left : at(x)._right;
+        }
+        at(z)._parent = y;
+        if (y == nil)
+            head()._root = z;
+        else if (key_less(z, y))
+            at(y)._left = z;
+        else
+            at(y)._right = z;
+        insert_fix(z);
+    }
+
+    void erase(uint64_t _index)
+    {
+        offset z = find(_index);
+
+        if (z == nil)
+            return ;
+        modify();
+        unlink(z);
+        at(z)._left = head()._free;
+        head()._free = z;
+    }
+
+    // the string at _index, or an empty one past the end
+    string get(uint64_t _index) const
+    {
+        offset x = find(_index);
+
+        if (x == nil)
+            return (string());
+        return (string(_base + at(x)._key, at(x)._length));
+    }
+
+    uint64_t size() const
+    {
+        return (at(head()._root)._count);
+    }
+
+    // Writes everything back and marks the file consistent.
+    void sync()
+    {
+        if (::msync(_base, head()._end, MS_SYNC) != 0)
+            throw runtime_error("cannot sync " + _path + ": " + strerror(errno));
+        head()._clean = 1;
+        if (::msync(_base, header_size, MS_SYNC) != 0)
+            throw runtime_error("cannot sync " + _path + ": " + strerror(errno));
+    }
+
+    // Rewrites the file with only the live tree, nodes in key order and
+    // perfectly balanced followed by their keys, which gives back the
+    // space of erased keys and nodes. The new file is built next to the
+    // old one and renamed over it, so a crash leaves one or the other.
+    // O(n); throws runtime_error on I/O errors, leaving the tree as it
+    // was.
+    void compact()
+    {
+        vector<offset> order;
+        uint64_t key_bytes = 0;
+
+        order.reserve(size());
+        for (offset x = first(); x != nil; x = next(x))
+        {
+            order.push_back(x);
+            key_bytes += (at(x)._length + 7) & ~uint64_t(7);
+        }
+
+        string tmp = _path + ".tmp";
+        size_t length = nil + sizeof(node) * (order.size() + 1) + key_bytes;
+        int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        void* base = MAP_FAILED;
+
+        if (fd < 0)
+            throw runtime_error("cannot create " + tmp + ": " + strerror(errno));
+        try
+        {
+            if (::ftruncate(fd, length) != 0)
+                throw runtime_error("cannot grow " + tmp + ": " + strerror(errno));
+            base = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (base == MAP_FAILED)
+                throw runtime_error("cannot map " + tmp + ": " + strerror(errno));
+            write_compact(static_cast<char*>(base), order);
+            if (::msync(base, length, MS_SYNC) != 0)
+                throw runtime_error("cannot sync " + tmp + ": " + strerror(errno));
+            if (::rename(tmp.c_str(), _path.c_str()) != 0)
+                throw runtime_error("cannot rename " + tmp + ": " + strerror(errno));
+        }
+        catch (...)
+        {
+            if (base != MAP_FAILED)
+                ::munmap(base, length);
+            ::close(fd);
+            ::unlink(tmp.c_str());
+            throw ;
+        }
+        ::munmap(_base, _capacity);
+        ::close(_fd);
+        _fd = fd;
+        _base = static_cast<char*>(base);
+        _capacity = length;
+        sync_directory(_path);
+    }
+
+private:
+    typedef uint64_t offset;
+
+    enum color { black = 0, red = 1 };
+
+    struct header
+    {
+        char _magic[8];
+        uint64_t _clean;
+        offset _root;
+        // erased nodes, linked through _left
+        offset _free;
+        // bytes of the arena in use; the file may be longer
+        uint64_t _end;
+    };
+
+    struct node
+    {
+        offset _left;
+        offset _right;
+        offset _parent;
+        uint64_t _count;
+        offset _key;
+        uint32_t _length;
+        uint32_t _color;
+    };
+
+    // the header gets a page of its own, so marking the file dirty
+    // syncs nothing else; the sentinel node follows it
+    static const size_t header_size = 4096;
+    static const offset nil = header_size;
+    static const size_t initial_capacity = 1 << 20;
+
+    string _path;
+    int _fd;
+    char* _base;
+    size_t _capacity;
+
+    static const char* magic()
+    {
+        return ("STORMAP1");
+    }
+
+    header& head() const
+    {
+        return (*reinterpret_cast<header*>(_base));
+    }
+
+    node& at(offset _off) const
+    {
+        return (*reinterpret_cast<node*>(_base + _off));
+    }
+
+    void create()
+    {
+        map(initial_capacity);
+        memcpy(head()._magic, magic(), 8);
+        head()._clean = 1;
+        head()._root = nil;
+        head()._free = 0;
+        head()._end = nil + sizeof(node);
+        at(nil) = node();
+        at(nil)._color = black;
+        sync();
+    }
+
+    // Checks the header before anything follows its offsets: the arena
+    // has to fit the file and the root and free list head have to be
+    // nodes inside it. Deeper damage is what the clean mark is for.
+    void open_existing(size_t _length)
+    {
+        if (_length < nil + sizeof(node))
+            throw runtime_error(_path + " is not a mapped tree");
+        map(_length);
+        if (memcmp(head()._magic, magic(), 8) != 0 || head()._end < nil + sizeof(node) || head()._end > _capacity
+            || (head()._root != nil && !is_node(head()._root)) || (head()._free != 0 && !is_node(head()._free)))
+            throw runtime_error(_path + " is not a mapped tree");
+        if (head()._clean != 1)
+            throw runtime_error(_path + " was not synced before it was last closed");
+    }
+
+    // whether a node at _off lies within the arena, past the sentinel
+    bool is_node(offset _off) const
+    {
+        return (_off % 8 == 0 && _off >= nil + sizeof(node) && _off <= head()._end - sizeof(node));
+    }
+
+    // (Re)maps the file at _length bytes, growing it if needed. The old
+    // mapping is only dropped once the new one is in place, so on failure
+    // the tree is still there as it was.
+    void map(size_t _length)
+    {
+        if (_length > _capacity && ::ftruncate(_fd, _length) != 0)
+            throw runtime_error("cannot grow " + _path + ": " + strerror(errno));
+
+        void* base = ::mmap(nullptr, _length, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+
+        if (base == MAP_FAILED)
+            throw runtime_error("cannot map " + _path + ": " + strerror(errno));
+        if (_base != nullptr)
+            ::munmap(_base, _capacity);
+        _base = static_cast<char*>(base);
+        _capacity = _length;
+    }
+
+    offset first() const
+    {
+        offset x = head()._root;
+
+        if (x == nil)
+            return (nil);
+        while (at(x)._left != nil)
+            x = at(x)._left;
+        return (x);
+    }
+
+    // in-order successor, nil after the last node
+    offset next(offset _x) const
+    {
+        if (at(_x)._right != nil)
+        {
+            _x = at(_x)._right;
+            while (at(_x)._left != nil)
+                _x = at(_x)._left;
+            return (_x);
+        }
+
+        offset p = at(_x)._parent;
+
+        while (p != nil && _x == at(p)._right)
+        {
+            _x = p;
+            p = at(p)._parent;
+        }
+        return (p);
+    }
+
+    // Lays the nodes _order out in key order at the start of _out's arena,
+    // as a tree built the way RedBlackTree::buildSorted does, and their
+    // keys after them. _out is a clean header away from being a file.
+    void write_compact(char* _out, const vector<offset>& _order) const
+    {
+        header& out = *reinterpret_cast<header*>(_out);
+        size_t n = _order.size();
+        size_t full = 0;
+        offset key = nil + sizeof(node) * (n + 1);
+
+        // depth of the deepest level that is completely filled
+        while ((size_t(2) << full) - 1 <= n)
+            full++;
+        memcpy(out._magic, magic(), 8);
+        out._clean = 1;
+        out._free = 0;
+        *reinterpret_cast<node*>(_out + nil) = node();
+        reinterpret_cast<node*>(_out + nil)->_color = black;
+        for (size_t i = 0; i < n; i++)
+        {
+            node& copy = *reinterpret_cast<node*>(_out + nil + sizeof(node) * (i + 1));
+
+            copy._key = key;
+            copy._length = at(_order[i])._length;
+            memcpy(_out + key, _base + at(_order[i])._key, copy._length);
+            key += (copy._length + 7) & ~uint64_t(7);
+        }
+        out._end = key;
+        out._root = build_compact(_out, 0, n, 0, (size_t(1) << full) - 1 == n ? size_t(-1) : full, nil);
+    }
+
+    // links nodes [_first, _first + _n) of _out into a subtree, red at
+    // _red_depth, and returns its root
+    static offset build_compact(char* _out, size_t _first, size_t _n, size_t _depth, size_t _red_depth, offset _parent)
+    {
+        if (_n == 0)
+            return (nil);
+
+        size_t half = _n / 2;
+        offset off = nil + sizeof(node) * (_first + half + 1);
+        node& x = *reinterpret_cast<node*>(_out + off);
+
+        x._parent = _parent;
+        x._color = _depth == _red_depth ? red : black;
+        x._count = _n;
+        x._left = build_compact(_out, _first, half, _depth + 1, _red_depth, off);
+        x._right = build_compact(_out, _first + half + 1, _n - half - 1, _depth + 1, _red_depth, off);
+        return (off);
+    }
+
+    // Clears the clean mark, on disk, before the first change after a
+    // sync, so no change can reach the disk ahead of it.
+    void modify()
+    {
+        if (head()._clean == 0)
+            return ;
+        head()._clean = 0;
+        if (::msync(_base, header_size, MS_SYNC) != 0)
+            throw runtime_error("cannot sync " + _path + ": " + strerror(errno));
+    }
+
+    // _length bytes at the end of the arena, 8-byte aligned. Remaps, so
+    // no node reference may be held across it.
+    offset reserve(size_t _length)
+    {
+        offset off = head()._end;
+        size_t end = off + ((_length + 7) & ~static_cast<size_t>(7));
+
+        if (end > _capacity)
+            map(max(_capacity * 2, end));
+        head()._end = end;
+        return (off);
+    }
+
+    // a red leaf holding a copy of _str, not yet linked in
+    offset allocate_node(const string& _str)
+    {
+        offset key = reserve(_str.size());
+        offset z = head()._free;
+
+        memcpy(_base + key, _str.data(), _str.size());
+        if (z != 0)
+            head()._free = at(z)._left;
+        else
+            z = reserve(sizeof(node));
+
+        node& n = at(z);
+
+        n._left = nil;
+        n._right = nil;
+        n._parent = nil;
+        n._count = 1;
+        n._key = key;
+        n._length = _str.size();
+        n._color = red;
+        return (z);
+    }
+
+    bool key_less(offset _a, offset _b) const
+    {
+        const node& a = at(_a);
+        const node& b = at(_b);
+        int cmp = memcmp(_base + a._key, _base + b._key, min(a._length, b._length));
+
+        return (cmp < 0 || (cmp == 0 && a._length < b._length));
+    }
+
+    offset find(uint64_t _index) const
+    {
+        offset x = head()._root;
+
+        while (x != nil)
+        {
+            uint64_t left = at(at(x)._left)._count;
+
+            if (_index < left)
+                x = at(x)._left;
+            else if (_index == left)
+                break ;
+            else
+            {
+                _index -= left + 1;
+                x = at(x)._right;
+            }
+        }
+        return (x);
+    }
+
+    void recount(offset _x)
+    {
+        at(_x)._count = at(at(_x)._left)._count + at(at(_x)._right)._count + 1;
+    }
+
+    void left_rotate(offset _x)
+    {
+        offset y = at(_x)._right;
+
+        at(_x)._right = at(y)._left;
+        if (at(y)._left != nil)
+            at(at(y)._left)._parent = _x;
+        at(y)._parent = at(_x)._parent;
+        if (at(_x)._parent == nil)
+            head()._root = y;
+        else if (_x == at(at(_x)._parent)._left)
+            at(at(_x)._parent)._left = y;
+        else
+            at(at(_x)._parent)._right = y;
+        at(y)._left = _x;
+        at(_x)._parent = y;
+        recount(_x);
+        recount(y);
+    }
+
+    void right_rotate(offset _x)
+    {
+        offset y = at(_x)._left;
+
+        at(_x)._left = at(y)._right;
+        if (at(y)._right != nil)
+            at(at(y)._right)._parent = _x;
+        at(y)._parent = at(_x)._parent;
+        if (at(_x)._parent == nil)
+            head()._root = y;
+        else if (_x == at(at(_x)._parent)._right)
+            at(at(_x)._parent)._right = y;
+        else
+            at(at(_x)._parent)._left = y;
+        at(y)._right = _x;
+        at(_x)._parent = y;
+        recount(_x);
+        recount(y);
+    }
+
+    void insert_fix(offset _k)
+    {
+        while (at(at(_k)._parent)._color == red)
+        {
+            offset p = at(_k)._parent;
+            offset g = at(p)._parent;
+
+            if (p == at(g)._right)
+            {
+                offset u = at(g)._left;
+
+                if (at(u)._color == red)
+                {
+                    at(u)._color = black;
+                    at(p)._color = black;
+                    at(g)._color = red;
+                    _k = g;
+                    continue ;
+                }
+                if (_k == at(p)._left)
+                {
+                    _k = p;
+                    right_rotate(_k);
+                }
+                at(at(_k)._parent)._color = black;
+                at(g)._color = red;
+                left_rotate(g);
+            }
+            else
+            {
+                offset u = at(g)._right;
+
+                if (at(u)._color == red)
+                {
+                    at(u)._color = black;
+                    at(p)._color = black;
+                    at(g)._color = red;
+                    _k = g;
+                    continue ;
+                }
+                if (_k == at(p)._right)
+                {
+                    _k = p;
+                    left_rotate(_k);
+                }
+                at(at(_k)._parent)._color = black;
+                at(g)._color = red;
+                right_rotate(g);
+            }
+        }
+        at(head()._root)._color = black;
+    }
+
+    void transplant(offset _u, offset _v)
+    {
+        offset parent = at(_u)._parent;
+
+        if (parent == nil)
+            head()._root = _v;
+        else if (_u == at(parent)._left)
+            at(parent)._left = _v;
+        else
+            at(parent)._right = _v;
+        if (_v != nil)
+            at(_v)._parent = parent;
+    }
+
+    // Unlinks _z and rebalances, as RedBlackTree::unlinkNode does.
+    void unlink(offset _z)
+    {
+        offset x;
+        offset xp;
+        offset y = _z;
+        uint32_t y_color = at(y)._color;
+
+        if (at(_z)._left == nil)
+        {
+            x = at(_z)._right;
+            xp = at(_z)._parent;
+            transplant(_z, x);
+        }
+        else if (at(_z)._right == nil)
+        {
+            x = at(_z)._left;
+            xp = at(_z)._parent;
+            transplant(_z, x);
+        }
+        else
+        {
+            y = at(_z)._right;
+            while (at(y)._left != nil)
+                y = at(y)._left;
+            y_color = at(y)._color;
+            x = at(y)._right;
+            if (at(y)._parent == _z)
+                xp = y;
+            else
+            {
+                xp = at(y)._parent;
+                transplant(y, x);
+                at(y)._right = at(_z)._right;
+                at(at(y)._right)._parent = y;
+            }
+            transplant(_z, y);
+            at(y)._left = at(_z)._left;
+            at(at(y)._left)._parent = y;
+            at(y)._color = at(_z)._color;
+        }
+        for (offset up = xp; up != nil; up = at(up)._parent)
+            recount(up);
+        if (y_color == black)
+            erase_fix(x, xp);
+    }
+
+    void erase_fix(offset _x, offset _xp)
+    {
+        while (_x != head()._root && at(_x)._color == black)
+        {
+            if (_x == at(_xp)._left)
+            {
+                offset s = at(_xp)._right;
+
+                if (at(s)._color == red)
+                {
+                    at(s)._color = black;
+                    at(_xp)._color = red;
+                    left_rotate(_xp);
+                    s = at(_xp)._right;
+                }
+                if (at(at(s)._left)._color == black && at(at(s)._right)._color == black)
+                {
+                    at(s)._color = red;
+                    _x = _xp;
+                    _xp = at(_xp)._parent;
+                    continue ;
+                }
+                if (at(at(s)._right)._color == black)
+                {
+                    at(at(s)._left)._color = black;
+                    at(s)._color = red;
+                    right_rotate(s);
+                    s = at(_xp)._right;
+                }
+                at(s)._color = at(_xp)._color;
+                at(_xp)._color = black;
+                at(at(s)._right)._color = black;
+                left_rotate(_xp);
+            }
+            else
+            {
+                offset s = at(_xp)._left;
+
+                if (at(s)._color == red)
+                {
+                    at(s)._color = black;
+                    at(_xp)._color = red;
+                    right_rotate(_xp);
+                    s = at(_xp)._left;
+                }
+                if (at(at(s)._right)._color == black && at(at(s)._left)._color == black)
+                {
+                    at(s)._color = red;
+                    _x = _xp;
+                    _xp = at(_xp)._parent;
+                    continue ;
+                }
+                if (at(at(s)._left)._color == black)
+                {
+                    at(at(s)._right)._color = black;
+                    at(s)._color = red;
+                    left_rotate(s);
+                    s = at(_xp)._left;
+                }
+                at(s)._color = at(_xp)._color;
+                at(_xp)._color = black;
+                at(at(s)._left)._color = black;
+                right_rotate(_xp);
+            }
+            _x = head()._root;
+        }
+        if (_x != nil)
+            at(_x)._color = black;
+    }
+};
+
+#endif
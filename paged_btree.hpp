@@ -0,0 +1,800 @@
+#ifndef PAGED_BTREE_HPP
+# define PAGED_BTREE_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// storage for data larger than memory: an order-statistic B-tree in
+// fixed-size file pages, cached by a buffer pool of bounded size.
+//
+// Inner pages hold, per child, its page number and the number of keys
+// under it, plus the separator keys that route inserts; leaf pages hold
+// the keys. A rank is found by reading one page per level, so get and
+// erase cost O(log_B n) page reads, B being the keys a page holds.
+// Pages split when their encoding outgrows the page. A page whose
+// encoding drops below a quarter page is merged with a sibling, or
+// takes half of the sibling's bytes if both would not fit in one page;
+// the new separator that then goes up may in turn split its parent.
+// Pages freed by merges go on a free list, linked through the pages
+// themselves, that new pages are taken from first.
+//
+// The pool keeps decoded pages in a fixed number of frames and picks
+// victims by CLOCK: a frame is passed over once after each use and
+// written back, if dirty, when it goes. Pages are read and written with
+// pread and pwrite at their offset.
+//
+// Page 0 holds the root, the page count, the key count and the head of
+// the free list. As in mapped_storage, the file is only consistent after
+// flush() or the destructor; a file left behind by a crash in between is
+// refused.
+//
+// Unlike storage, get returns a copy, since the page holding a string
+// may be evicted right after, and there is no save: the file is the
+// persistent form and flush() makes it consistent.
+class paged_storage
+{
+public:
+    static const size_t page_size = 4096;
+    // keeps at least three of the longest keys in a page
+    static const size_t max_key = page_size / 4;
+    // an insert or erase pins one page per level plus a sibling; a
+    // smaller budget throws invalid_argument
+    static const size_t min_budget = 64 * page_size;
+
+    explicit paged_storage(const string& _file, size_t _memory_budget = 64 << 20) :
+        _path(_file), _fd(-1), _hand(0), _reads(0)
+    {
+        struct stat st;
+
+        if (_memory_budget < min_budget)
+            throw invalid_argument("paged_storage needs a memory budget of at least "
+                + to_string(min_budget / 1024) + " KiB");
+        _frames.resize(_memory_budget / page_size);
+        _fd = ::open(_path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (_fd < 0)
+            throw runtime_error("cannot open " + _path + ": " + strerror(errno));
+        try
+        {
+            if (::fstat(_fd, &st) != 0)
+                throw runtime_error("cannot stat " + _path + ": " + strerror(errno));
+            if (st.st_size == 0)
+                create();
+            else
+                open_existing();
+        }
+        catch (...)
+        {
+            ::close(_fd);
+            throw ;
+        }
+    }
+
+    ~paged_storage()
+    {
+        try
+        {
+            flush();
+        }
+        catch (...)
+        {
+        }
+        ::close(_fd);
+    }
+
+    paged_storage(const paged_storage&) = delete;
+    paged_storage& operator=(const paged_storage&) = delete;
+
+    // equal keys go after the ones already present
+    void insert(const string& _str)
+    {
+        split up;
+
+        if (_str.size() > max_key)
+            throw length_error("paged_storage keys are limited to " + to_string(max_key) + " bytes");
+        modify();
+        if (insert_into(_meta._root, _str, up))
+            grow_root(_meta._size + 1, up);
+        _meta._size++;
+    }
+
+    void erase(uint64_t _index)
+    {
+        split up;
+
+        if (_index >= _meta._size)
+            return ;
+        modify();
+        _meta._size--;
+        if (erase_from(_meta._root, _index, up) == overfull)
+            grow_root(_meta._size, up);
+
+        // a root left with one child hands the tree down to it
+        frame& root = fetch(_meta._root);
+
+        if (!root._page._leaf && root._page._children.size() == 1)
+        {
+            _meta._root = root._page._children[0];
+            free_page(root);
+        }
+        release(root);
+    }
+
+    // Same result as erase(op.first) followed by insert(op.second) for
+    // every op in order. The ops are applied one by one: pages are the
+    // unit of I/O here, and ops on nearby ranks already share them
+    // through the pool.
+    void apply_batch(const vector<pair<uint64_t, string> >& _ops)
+    {
+        for (const pair<uint64_t, string>& op : _ops)
+        {
+            erase(op.first);
+            insert(op.second);
+        }
+    }
+
+    // the string at _index, or an empty one past the end
+    string get(uint64_t _index)
+    {
+        if (_index >= _meta._size)
+            return (string());
+
+        uint64_t id = _meta._root;
+
+        for (;;)
+        {
+            frame& f = fetch(id);
+            page& p = f._page;
+
+            if (p._leaf)
+            {
+                string key = p._keys[_index];
+
+                release(f);
+                return (key);
+            }
+            id = p._children[locate(p, _index)];
+            release(f);
+        }
+    }
+
+    uint64_t size() const
+    {
+        return (_meta._size);
+    }
+
+    // number of strings less than _str
+    uint64_t count_less(const string& _str)
+    {
+        uint64_t id = _meta._root;
+        uint64_t before = 0;
+
+        for (;;)
+        {
+            frame& f = fetch(id);
+            page& p = f._page;
+
+            if (p._leaf)
+            {
+                before += lower_bound(p._keys.begin(), p._keys.end(), _str) - p._keys.begin();
+                release(f);
+                return (before);
+            }
+
+            // children before i hold keys up to a separator below _str
+            size_t i = lower_bound(p._keys.begin(), p._keys.end(), _str) - p._keys.begin();
+
+            for (size_t j = 0; j < i; j++)
+                before += p._counts[j];
+            id = p._children[i];
+            release(f);
+        }
+    }
+
+    // pages read from the file so far, for judging the pool
+    uint64_t page_reads() const
+    {
+        return (_reads);
+    }
+
+    // pages in the file, the meta page and free ones included
+    uint64_t page_count() const
+    {
+        return (_meta._pages);
+    }
+
+    // Writes back every dirty page and marks the file consistent.
+    void flush()
+    {
+        for (frame& f : _frames)
+        {
+            if (f._id != 0 && f._dirty)
+                write_page(f);
+        }
+        sync_file();
+        _meta._clean = 1;
+        write_meta();
+        sync_file();
+    }
+
+private:
+    // a decoded page
+    struct page
+    {
+        bool _leaf;
+        // on the free list, _next being the free page after it or 0
+        bool _free;
+        uint64_t _next;
+        // a leaf's keys, or an inner page's separators: _keys[i] is the
+        // smallest key child i + 1 takes
+        vector<string> _keys;
+        vector<uint64_t> _children;
+        vector<uint64_t> _counts;
+    };
+
+    struct frame
+    {
+        // 0 while empty; page 0 is never cached
+        uint64_t _id;
+        unsigned _pins;
+        bool _referenced;
+        bool _dirty;
+        page _page;
+
+        frame() : _id(0), _pins(0), _referenced(false), _dirty(false) {}
+    };
+
+    struct meta
+    {
+        uint64_t _clean;
+        uint64_t _root;
+        uint64_t _pages;
+        uint64_t _size;
+        // first free page, 0 if none; files from before the free list
+        // have zeros here
+        uint64_t _free;
+    };
+
+    // what a split page hands up to its parent
+    struct split
+    {
+        string _separator;
+        uint64_t _page;
+        uint64_t _moved;
+    };
+
+    static const size_t page_header = 8;
+
+    // what an erase left a page as
+    enum change { unchanged, underfull, overfull };
+
+    string _path;
+    int _fd;
+    meta _meta;
+    vector<frame> _frames;
+    unordered_map<uint64_t, size_t> _table;
+    size_t _hand;
+    uint64_t _reads;
+
+    static const char* magic()
+    {
+        return ("STORPGB1");
+    }
+
+    void create()
+    {
+        _meta._clean = 1;
+        _meta._pages = 1;
+        _meta._size = 0;
+        _meta._free = 0;
+
+        frame& root = create_page(true, _meta._root);
+
+        release(root);
+        flush();
+    }
+
+    void open_existing()
+    {
+        char buffer[page_size];
+
+        read_page_at(0, buffer);
+        if (memcmp(buffer, magic(), 8) != 0)
+            throw runtime_error(_path + " is not a paged tree");
+        memcpy(&_meta, buffer + 8, sizeof(_meta));
+        if (_meta._root == 0 || _meta._root >= _meta._pages || _meta._free >= _meta._pages)
+            throw runtime_error(_path + " is not a paged tree");
+        if (_meta._clean != 1)
+            throw runtime_error(_path + " was not flushed before it was last closed");
+    }
+
+    // Clears the clean mark, on disk, before the first change after a
+    // flush, so no page written back later can reach the disk ahead of it.
+    void modify()
+    {
+        if (_meta._clean == 0)
+            return ;
+        _meta._clean = 0;
+        write_meta();
+        sync_file();
+    }
+
+    // Inserts _str under page _id. Returns true if the page had to
+    // split, with the new right sibling described in _up.
+    bool insert_into(uint64_t _id, const string& _str, split& _up)
+    {
+        frame& f = fetch(_id);
+        page& p = f._page;
+
+        f._dirty = true;
+        if (p._leaf)
+            p._keys.insert(upper_bound(p._keys.begin(), p._keys.end(), _str), _str);
+        else
+        {
+            size_t i = upper_bound(p._keys.begin(), p._keys.end(), _str) - p._keys.begin();
+            split below;
+
+            p._counts[i]++;
+            if (insert_into(p._children[i], _str, below))
+                adopt(p, i, below);
+        }
+
+        bool full = encoded_size(p) > page_size;
+
+        if (full)
+            split_page(p, _up);
+        release(f);
+        return (full);
+    }
+
+    // Erases rank _index under page _id and says what became of the
+    // page: an underfull one is left for its parent to merge or
+    // rebalance, an overfull one is split as on insert, with the new
+    // right sibling described in _up. Only inner pages overflow, when a
+    // rebalance below hands them a longer separator.
+    change erase_from(uint64_t _id, uint64_t _index, split& _up)
+    {
+        frame& f = fetch(_id);
+        page& p = f._page;
+        change result = unchanged;
+
+        f._dirty = true;
+        if (p._leaf)
+            p._keys.erase(p._keys.begin() + _index);
+        else
+        {
+            size_t i = locate(p, _index);
+            split below;
+
+            p._counts[i]--;
+            switch (erase_from(p._children[i], _index, below))
+            {
+            case underfull:
+                if (p._children.size() > 1)
+                    rebalance(p, i);
+                break ;
+            case overfull:
+                adopt(p, i, below);
+                break ;
+            default:
+                break ;
+            }
+        }
+
+        size_t size = encoded_size(p);
+
+        if (size > page_size)
+        {
+            split_page(p, _up);
+            result = overfull;
+        }
+        else if (size < page_size / 4)
+            result = underfull;
+        release(f);
+        return (result);
+    }
+
+    // Merges the underfull child _i of _parent with a sibling, pulling
+    // the separator between them down into inner pages. If the two do
+    // not fit in one page, the bytes are split evenly between them again.
+    void rebalance(page& _parent, size_t _i)
+    {
+        size_t l = _i + 1 < _parent._children.size() ? _i : _i - 1;
+        frame& left_frame = fetch(_parent._children[l]);
+        frame& right_frame = fetch(_parent._children[l + 1]);
+        page& left = left_frame._page;
+        page& right = right_frame._page;
+        uint64_t total = _parent._counts[l] + _parent._counts[l + 1];
+
+        left_frame._dirty = true;
+        right_frame._dirty = true;
+        if (!left._leaf)
+            left._keys.push_back(move(_parent._keys[l]));
+        left._keys.insert(left._keys.end(), make_move_iterator(right._keys.begin()),
+            make_move_iterator(right._keys.end()));
+        left._children.insert(left._children.end(), right._children.begin(), right._children.end());
+        left._counts.insert(left._counts.end(), right._counts.begin(), right._counts.end());
+        right._keys.clear();
+        right._children.clear();
+        right._counts.clear();
+        if (encoded_size(left) <= page_size)
+        {
+            _parent._counts[l] = total;
+            _parent._children.erase(_parent._children.begin() + l + 1);
+            _parent._counts.erase(_parent._counts.begin() + l + 1);
+            _parent._keys.erase(_parent._keys.begin() + l);
+            free_page(right_frame);
+        }
+        else
+        {
+            split up;
+
+            move_upper_half(left, right, up);
+            _parent._keys[l] = move(up._separator);
+            _parent._counts[l] = total - up._moved;
+            _parent._counts[l + 1] = up._moved;
+        }
+        release(left_frame);
+        release(right_frame);
+    }
+
+    // Links the new right sibling of child _i, described in _up, into
+    // the inner page _p.
+    static void adopt(page& _p, size_t _i, split& _up)
+    {
+        _p._counts[_i] -= _up._moved;
+        _p._children.insert(_p._children.begin() + _i + 1, _up._page);
+        _p._counts.insert(_p._counts.begin() + _i + 1, _up._moved);
+        _p._keys.insert(_p._keys.begin() + _i, move(_up._separator));
+    }
+
+    // Puts a new root over the old one, which holds _size strings in all
+    // and has just split off _up.
+    void grow_root(uint64_t _size, split& _up)
+    {
+        uint64_t id;
+        frame& root = create_page(false, id);
+
+        root._page._children.push_back(_meta._root);
+        root._page._counts.push_back(_size - _up._moved);
+        root._page._children.push_back(_up._page);
+        root._page._counts.push_back(_up._moved);
+        root._page._keys.push_back(move(_up._separator));
+        release(root);
+        _meta._root = id;
+    }
+
+    // Moves the upper half of _full, by bytes, into a new page.
+    void split_page(page& _full, split& _up)
+    {
+        frame& sibling = create_page(_full._leaf, _up._page);
+
+        move_upper_half(_full, sibling._page, _up);
+        release(sibling);
+    }
+
+    // Moves the upper half of _full, by bytes, into the empty page
+    // _right and says in _up what the parent needs to know, but for
+    // _up._page.
+    void move_upper_half(page& _full, page& _right, split& _up)
+    {
+        size_t n = _full._leaf ? _full._keys.size() : _full._children.size();
+        size_t total = encoded_size(_full) - page_header;
+        size_t left_bytes = 0;
+        size_t m = 0;
+
+        // keep the first m entries, at least one on either side
+        while (m + 1 < n && (m == 0 || left_bytes < total / 2))
+            left_bytes += entry_size(_full, m++);
+        if (_full._leaf)
+        {
+            _right._keys.assign(_full._keys.begin() + m, _full._keys.end());
+            _full._keys.resize(m);
+            _up._separator = _right._keys[0];
+            _up._moved = n - m;
+        }
+        else
+        {
+            _right._children.assign(_full._children.begin() + m, _full._children.end());
+            _right._counts.assign(_full._counts.begin() + m, _full._counts.end());
+            _right._keys.assign(_full._keys.begin() + m, _full._keys.end());
+            _up._separator = move(_full._keys[m - 1]);
+            _full._children.resize(m);
+            _full._counts.resize(m);
+            _full._keys.resize(m - 1);
+            _up._moved = 0;
+            for (uint64_t count : _right._counts)
+                _up._moved += count;
+        }
+    }
+
+    // child holding rank _index, which becomes the rank inside it
+    static size_t locate(const page& _p, uint64_t& _index)
+    {
+        size_t i = 0;
+
+        for (; i + 1 < _p._children.size(); i++)
+        {
+            if (_index < _p._counts[i])
+                break ;
+            _index -= _p._counts[i];
+        }
+        return (i);
+    }
+
+    // bytes entry _i takes in the encoding: a key, or a child with its
+    // count and the separator after it
+    static size_t entry_size(const page& _p, size_t _i)
+    {
+        if (_p._leaf)
+            return (2 + _p._keys[_i].size());
+        return (16 + (_i < _p._keys.size() ? 2 + _p._keys[_i].size() : 0));
+    }
+
+    static size_t encoded_size(const page& _p)
+    {
+        size_t n = _p._leaf ? _p._keys.size() : _p._children.size();
+        size_t bytes = page_header;
+
+        for (size_t i = 0; i < n; i++)
+            bytes += entry_size(_p, i);
+        return (bytes);
+    }
+
+    // Layout: type byte, 3 unused, u32 entry count, then for an inner
+    // page every child and count as u64 pairs, then the keys as u16
+    // length and bytes. A free page holds only the next free page.
+    static void encode(const page& _p, char* _buffer)
+    {
+        uint32_t n = _p._leaf ? _p._keys.size() : _p._children.size();
+        size_t pos = page_header;
+
+        memset(_buffer, 0, page_size);
+        if (_p._free)
+        {
+            _buffer[0] = 2;
+            memcpy(_buffer + pos, &_p._next, sizeof(_p._next));
+            return ;
+        }
+        _buffer[0] = _p._leaf ? 0 : 1;
+        memcpy(_buffer + 4, &n, sizeof(n));
+        for (size_t i = 0; i < _p._children.size(); i++)
+        {
+            memcpy(_buffer + pos, &_p._children[i], 8);
+            memcpy(_buffer + pos + 8, &_p._counts[i], 8);
+            pos += 16;
+        }
+        for (const string& key : _p._keys)
+        {
+            uint16_t length = key.size();
+
+            memcpy(_buffer + pos, &length, sizeof(length));
+            memcpy(_buffer + pos + 2, key.data(), length);
+            pos += 2 + length;
+        }
+    }
+
+    void decode(const char* _buffer, uint64_t _id, page& _p)
+    {
+        uint32_t n;
+        size_t pos = page_header;
+
+        memcpy(&n, _buffer + 4, sizeof(n));
+        _p._leaf = _buffer[0] != 1;
+        _p._free = _buffer[0] == 2;
+        _p._next = 0;
+        _p._keys.clear();
+        _p._children.clear();
+        _p._counts.clear();
+        if (_p._free)
+            memcpy(&_p._next, _buffer + pos, sizeof(_p._next));
+        else if (!_p._leaf)
+        {
+            if (n == 0 || n > (page_size - page_header) / 16)
+                throw runtime_error(_path + ": corrupt page " + to_string(_id));
+            _p._children.resize(n);
+            _p._counts.resize(n);
+            for (uint32_t i = 0; i < n; i++)
+            {
+                memcpy(&_p._children[i], _buffer + pos, 8);
+                memcpy(&_p._counts[i], _buffer + pos + 8, 8);
+                pos += 16;
+            }
+            n--;
+        }
+        else if (n > (page_size - page_header) / 2)
+            throw runtime_error(_path + ": corrupt page " + to_string(_id));
+        _p._keys.reserve(n);
+        for (uint32_t i = 0; i < n; i++)
+        {
+            uint16_t length;
+
+            if (pos + 2 > page_size)
+                throw runtime_error(_path + ": corrupt page " + to_string(_id));
+            memcpy(&length, _buffer + pos, sizeof(length));
+            if (pos + 2 + length > page_size)
+                throw runtime_error(_path + ": corrupt page " + to_string(_id));
+            _p._keys.emplace_back(_buffer + pos + 2, length);
+            pos += 2 + length;
+        }
+    }
+
+    // The frame holding page _id, read in if needed and pinned until
+    // release. Frames never move, so a pinned frame stays valid.
+    frame& fetch(uint64_t _id)
+    {
+        unordered_map<uint64_t, size_t>::iterator it = _table.find(_id);
+
+        if (it != _table.end())
+        {
+            frame& f = _frames[it->second];
+
+            f._pins++;
+            f._referenced = true;
+            return (f);
+        }
+
+        frame& f = evict();
+        char buffer[page_size];
+
+        read_page_at(_id * page_size, buffer);
+        _reads++;
+        decode(buffer, _id, f._page);
+        claim(f, _id);
+        return (f);
+    }
+
+    // a new, empty and dirty page, pinned; taken off the free list if
+    // there is one, else from the end of the file
+    frame& create_page(bool _leaf, uint64_t& _id)
+    {
+        frame* f;
+
+        if (_meta._free != 0)
+        {
+            _id = _meta._free;
+            f = &fetch(_id);
+            if (!f->_page._free || f->_page._next >= _meta._pages)
+                throw runtime_error(_path + ": corrupt free page " + to_string(_id));
+            _meta._free = f->_page._next;
+        }
+        else
+        {
+            f = &evict();
+            _id = _meta._pages++;
+            claim(*f, _id);
+        }
+        f->_page._leaf = _leaf;
+        f->_page._free = false;
+        f->_page._next = 0;
+        f->_page._keys.clear();
+        f->_page._children.clear();
+        f->_page._counts.clear();
+        f->_dirty = true;
+        return (*f);
+    }
+
+    // puts the page in _f, which stays pinned, on the free list
+    void free_page(frame& _f)
+    {
+        _f._page._free = true;
+        _f._page._next = _meta._free;
+        _f._page._keys.clear();
+        _f._page._children.clear();
+        _f._page._counts.clear();
+        _f._dirty = true;
+        _meta._free = _f._id;
+    }
+
+    void release(frame& _f)
+    {
+        _f._pins--;
+    }
+
+    void claim(frame& _f, uint64_t _id)
+    {
+        _f._id = _id;
+        _f._pins = 1;
+        _f._referenced = true;
+        _f._dirty = false;
+        _table[_id] = &_f - _frames.data();
+    }
+
+    // CLOCK: sweeps past pinned frames and clears the mark of used ones
+    // until it meets an unmarked one, which it writes back and empties.
+    frame& evict()
+    {
+        for (size_t swept = 0; swept < 2 * _frames.size() + 1; swept++)
+        {
+            frame& f = _frames[_hand];
+
+            _hand = (_hand + 1) % _frames.size();
+            if (f._pins > 0)
+                continue ;
+            if (f._referenced)
+            {
+                f._referenced = false;
+                continue ;
+            }
+            if (f._id != 0)
+            {
+                if (f._dirty)
+                    write_page(f);
+                _table.erase(f._id);
+                f._id = 0;
+            }
+            return (f);
+        }
+        throw runtime_error(_path + ": every buffer pool frame is pinned");
+    }
+
+    void write_page(frame& _f)
+    {
+        char buffer[page_size];
+
+        encode(_f._page, buffer);
+        write_page_at(_f._id * page_size, buffer);
+        _f._dirty = false;
+    }
+
+    void write_meta()
+    {
+        char buffer[page_size];
+
+        memset(buffer, 0, page_size);
+        memcpy(buffer, magic(), 8);
+        memcpy(buffer + 8, &_meta, sizeof(_meta));
+        write_page_at(0, buffer);
+    }
+
+    void read_page_at(uint64_t _offset, char* _buffer)
+    {
+        size_t done = 0;
+
+        while (done < page_size)
+        {
+            ssize_t got = ::pread(_fd, _buffer + done, page_size - done, _offset + done);
+
+            if (got < 0 && errno == EINTR)
+                continue ;
+            if (got <= 0)
+                throw runtime_error("cannot read " + _path + ": " + (got < 0 ? strerror(errno) : "short file"));
+            done += got;
+        }
+    }
+
+    void write_page_at(uint64_t _offset, const char* _buffer)
+    {
+        size_t done = 0;
+
+        while (done < page_size)
+        {
+            ssize_t written = ::pwrite(_fd, _buffer + done, page_size - done, _offset + done);
+
+            if (written < 0 && errno == EINTR)
+                continue ;
+            if (written < 0)
+                throw runtime_error("cannot write " + _path + ": " + strerror(errno));
+            done += written;
+        }
+    }
+
+    void sync_file()
+    {
+        if (::fdatasync(_fd) != 0)
+            throw runtime_error("cannot sync " + _path + ": " + strerror(errno));
+    }
+};
+
+#endif
@@ -0,0 +1,345 @@
+// Persistent order-statistic tree: every update copies the path it
+// touches and shares the rest, so old versions stay readable for free.
+
+#ifndef PERSISTENT_HPP
+# define PERSISTENT_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <utility>
+using namespace std;
+
+// A key as nodes hold it. Path copying rebuilds O(log n) nodes per
+// update, each with the key of the node it replaces, so keys that are
+// not trivially copyable (strings) live once in a reference counted box
+// the node versions share: copying the key is an atomic increment, not
+// a heap copy. Trivially copyable keys are just copied.
+template <class Key, bool Boxed = !is_trivially_copyable<Key>::value>
+class PersistentKey {
+   public:
+  explicit PersistentKey(const Key &k) : value(k) {}
+
+  const Key &get() const {
+    return value;
+  }
+
+   private:
+  Key value;
+};
+
+template <class Key>
+class PersistentKey<Key, true> {
+   public:
+  explicit PersistentKey(const Key &k) : box(new Box(k)) {}
+
+  explicit PersistentKey(Key &&k) : box(new Box(std::move(k))) {}
+
+  PersistentKey(const PersistentKey &other) : box(other.box) {
+    box->refs.fetch_add(1, memory_order_relaxed);
+  }
+
+  PersistentKey &operator=(const PersistentKey &) = delete;
+
+  ~PersistentKey() {
+    if (box->refs.fetch_sub(1, memory_order_acq_rel) == 1) {
+      delete box;
+    }
+  }
+
+  const Key &get() const {
+    return box->value;
+  }
+
+   private:
+  struct Box {
+    Key value;
+    atomic<size_t> refs;
+
+    template <class K>
+    explicit Box(K &&k) : value(std::forward<K>(k)), refs(1) {}
+  };
+
+  Box *box;
+};
+
+// Nodes are immutable once built; only refs changes. A node holds one
+// reference to each child, trees and snapshots one to their root.
+template <class Key>
+struct PersistentNode {
+  PersistentKey<Key> key;
+  const PersistentNode *left;
+  const PersistentNode *right;
+  size_t count;
+  int height;
+  mutable atomic<size_t> refs;
+
+  explicit PersistentNode(const PersistentKey<Key> &k) : key(k), refs(1) {}
+};
+
+// AVL balanced rather than red-black: without parent links the
+// rebalancing has to be expressed bottom-up on the copied path anyway,
+// and height balance does that with one rebuild per level.
+//
+// Nodes are plain new/delete: they outlive the tree through snapshots,
+// so there is no allocator instance left to hand them back to.
+template <class Key, class Compare = less<Key> >
+class PersistentTree {
+   public:
+  typedef PersistentNode<Key> NodeType;
+  typedef const NodeType *NodePtr;
+  typedef PersistentKey<Key> KeyType;
+
+  // A frozen version. Copies share it; the nodes go when the last
+  // snapshot or tree using them does. Safe to read from any thread.
+  class Snapshot {
+   public:
+    Snapshot() : root(nullptr), ver(0) {}
+
+    Snapshot(const Snapshot &other) : root(retain(other.root)), ver(other.ver), comp(other.comp) {}
+
+    Snapshot &operator=(const Snapshot &other) {
+      NodePtr old = root;
+      root = retain(other.root);
+      ver = other.ver;
+      comp = other.comp;
+      release(old);
+      return *this;
+    }
+
+    ~Snapshot() {
+      release(root);
+    }
+
+    size_t size() const {
+      return count(root);
+    }
+
+    // number of updates the tree had seen when the snapshot was taken
+    uint64_t version() const {
+      return ver;
+    }
+
+    // key at index, nullptr past the end
+    const Key *find(size_t index) const {
+      return findIn(root, index);
+    }
+
+    size_t countLess(const Key &key) const {
+      return countLessIn(root, key, comp);
+    }
+
+   private:
+    friend class PersistentTree;
+
+    Snapshot(NodePtr r, uint64_t v, const Compare &c) : root(retain(r)), ver(v), comp(c) {}
+
+    NodePtr root;
+    uint64_t ver;
+    Compare comp;
+  };
+
+  explicit PersistentTree(const Compare &c = Compare()) : root(nullptr), ver(0), comp(c) {}
+
+  PersistentTree(const PersistentTree &) = delete;
+  PersistentTree &operator=(const PersistentTree &) = delete;
+
+  ~PersistentTree() {
+    release(root);
+  }
+
+  // O(1): the current root gains a reference, nothing is copied
+  Snapshot snapshot() const {
+    return Snapshot(root, ver, comp);
+  }
+
+  size_t size() const {
+    return count(root);
+  }
+
+  uint64_t version() const {
+    return ver;
+  }
+
+  const Key *find(size_t index) const {
+    return findIn(root, index);
+  }
+
+  size_t countLess(const Key &key) const {
+    return countLessIn(root, key, comp);
+  }
+
+  // Equal keys go after the ones already present, as in RedBlackTree.
+  // Copies the O(log n) nodes on the path, sharing their keys; snapshots
+  // keep the old ones.
+  void insert(const Key &key) {
+    KeyType k(key);
+    replaceRoot(insertHelper(root, k));
+  }
+
+  void insert(Key &&key) {
+    KeyType k(std::move(key));
+    replaceRoot(insertHelper(root, k));
+  }
+
+  void clear() {
+    replaceRoot(nullptr);
+  }
+
+  void deleteByIndex(size_t index) {
+    if (index < size()) {
+      replaceRoot(eraseHelper(root, index));
+    }
+  }
+
+   private:
+  NodePtr root;
+  uint64_t ver;
+  Compare comp;
+
+  static size_t count(NodePtr node) {
+    return node ? node->count : 0;
+  }
+
+  static int height(NodePtr node) {
+    return node ? node->height : 0;
+  }
+
+  static NodePtr retain(NodePtr node) {
+    if (node) {
+      node->refs.fetch_add(1, memory_order_relaxed);
+    }
+    return node;
+  }
+
+  // Drops one reference, freeing whatever only it kept alive. The climb
+  // goes no deeper than the tree is high.
+  static void release(NodePtr node) {
+    if (node && node->refs.fetch_sub(1, memory_order_acq_rel) == 1) {
+      release(node->left);
+      release(node->right);
+      delete node;
+    }
+  }
+
+  static const Key *findIn(NodePtr node, size_t index) {
+    while (node) {
+      size_t leftCnt = count(node->left);
+
+      if (index < leftCnt) {
+        node = node->left;
+      } else if (index == leftCnt) {
+        return &node->key.get();
+      } else {
+        index -= leftCnt + 1;
+        node = node->right;
+      }
+    }
+    return nullptr;
+  }
+
+  static size_t countLessIn(NodePtr node, const Key &key, const Compare &comp) {
+    size_t rank = 0;
+
+    while (node) {
+      if (comp(node->key.get(), key)) {
+        rank += count(node->left) + 1;
+        node = node->right;
+      } else {
+        node = node->left;
+      }
+    }
+    return rank;
+  }
+
+  void replaceRoot(NodePtr node) {
+    NodePtr old = root;
+    root = node;
+    ver++;
+    release(old);
+  }
+
+  // The helpers below hand out new references: make and balance take
+  // over the references to the children they are given, and callers
+  // retain whatever they pass on from a borrowed node.
+
+  static NodePtr make(const KeyType &key, NodePtr l, NodePtr r) {
+    NodeType *node = new NodeType(key);
+    node->left = l;
+    node->right = r;
+    node->count = count(l) + count(r) + 1;
+    node->height = max(height(l), height(r)) + 1;
+    return node;
+  }
+
+  static NodePtr balance(const KeyType &key, NodePtr l, NodePtr r) {
+    NodePtr result;
+
+    if (height(l) > height(r) + 1) {
+      if (height(l->left) >= height(l->right)) {
+        result = make(l->key, retain(l->left), make(key, retain(l->right), r));
+      } else {
+        NodePtr lr = l->right;
+        result = make(lr->key, make(l->key, retain(l->left), retain(lr->left)),
+                      make(key, retain(lr->right), r));
+      }
+      release(l);
+    } else if (height(r) > height(l) + 1) {
+      if (height(r->right) >= height(r->left)) {
+        result = make(r->key, make(key, l, retain(r->left)), retain(r->right));
+      } else {
+        NodePtr rl = r->left;
+        result = make(rl->key, make(key, l, retain(rl->left)),
+                      make(r->key, retain(rl->right), retain(r->right)));
+      }
+      release(r);
+    } else {
+      result = make(key, l, r);
+    }
+    return result;
+  }
+
+  NodePtr insertHelper(NodePtr node, const KeyType &key) {
+    if (!node) {
+      return make(key, nullptr, nullptr);
+    }
+    if (comp(key.get(), node->key.get())) {
+      return balance(node->key, insertHelper(node->left, key), retain(node->right));
+    }
+    return balance(node->key, retain(node->left), insertHelper(node->right, key));
+  }
+
+  static NodePtr eraseMin(NodePtr node) {
+    if (!node->left) {
+      return retain(node->right);
+    }
+    return balance(node->key, eraseMin(node->left), retain(node->right));
+  }
+
+  static NodePtr eraseHelper(NodePtr node, size_t index) {
+    size_t leftCnt = count(node->left);
+
+    if (index < leftCnt) {
+      return balance(node->key, eraseHelper(node->left, index), retain(node->right));
+    }
+    if (index > leftCnt) {
+      return balance(node->key, retain(node->left), eraseHelper(node->right, index - leftCnt - 1));
+    }
+    if (!node->left) {
+      return retain(node->right);
+    }
+    if (!node->right) {
+      return retain(node->left);
+    }
+
+    NodePtr successor = node->right;
+    while (successor->left) {
+      successor = successor->left;
+    }
+    return balance(successor->key, retain(node->left), eraseMin(node->right));
+  }
+};
+
+#endif
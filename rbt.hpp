@@ -1,4 +1,8 @@
+#include <future>
 #include <iostream>
+#include <iterator>
+#include <utility>
+#include <vector>
 #include "iterator.hpp"
 
 namespace ft
@@ -25,8 +29,14 @@ class RBTree {
 
 private:
 
+	// subtrees smaller than this are not worth a thread of their own
+	static const size_t parallel_clone_min = 1 << 14;
+
 	node_pointer 		_root;
 	node_pointer 		_sentinal;
+	// the greatest node, or the sentinal, so an end() hint is checked
+	// without a descent
+	node_pointer		_rightmost;
 	node_allocator _node_alloc;
 	allocator_type _val_alloc;
 	value_comp		_comp;
@@ -39,21 +49,19 @@ public:
 		return _size;
 	}
 
-	node_pointer get_root()
+	node_pointer get_root() const
 	{
 		return _root;
 	}
 
-	node_pointer create_node(const value_type &val = value_type(), bool is_sentinal = false)
+	template <class... Args>
+	node_pointer create_node(Args&&... args)
 	{
 		node_pointer node;
-		pointer new_val;
 
 		node = _node_alloc.allocate(1);
-		new_val = _val_alloc.allocate(1);
-
-		_val_alloc.construct(new_val, val);
-		_node_alloc.construct(node, node_type(new_val, nullptr, _sentinal, _sentinal, is_sentinal, 1));
+		_node_alloc.construct(node, node_type(nullptr, _sentinal, _sentinal, false, 1));
+		_val_alloc.construct(&node->data(), std::forward<Args>(args)...);
 
 		return (node);
 	}
@@ -61,89 +69,157 @@ public:
 	node_pointer copy_node(node_pointer to_copy)
 	{
 		node_pointer node;
-		pointer new_val;
 
 		node = _node_alloc.allocate(1);
-		new_val = _val_alloc.allocate(1);
+		_node_alloc.construct(node, node_type(nullptr, _sentinal, _sentinal, false, to_copy->_color, to_copy->_count));
+		_val_alloc.construct(&node->data(), to_copy->data());
 
-		_val_alloc.construct(new_val, *to_copy->_data);
-		_node_alloc.construct(node, node_type(new_val, nullptr, _sentinal, _sentinal, false, to_copy->_color, to_copy->_count));
+		return (node);
+	}
+
+	// the sentinal only carries links and a zero count, no value is built
+	node_pointer create_sentinal()
+	{
+		node_pointer node;
+
+		node = _node_alloc.allocate(1);
+		_node_alloc.construct(node, node_type(nullptr, nullptr, nullptr, true, 0, 0));
+		node->_parent = node;
+		node->_left = node;
+		node->_right = node;
 
 		return (node);
 	}
 
+	void delete_sentinal(node_pointer node)
+	{
+		_node_alloc.destroy(node);
+		_node_alloc.deallocate(node, 1);
+	}
+
 	//constructor
 	RBTree(const value_comp comp = value_comp(), const Allocator alloc = Allocator()) : _val_alloc(alloc),
 																							_comp(comp),
 																							_size(0)
 	{
 		_node_alloc = node_allocator();
-		_sentinal = create_node(value_type()) ;
-		_sentinal->_parent = _sentinal;
-		_sentinal->_color = 0;
-		_sentinal->_left = _sentinal;
-		_sentinal->_right = _sentinal;
-		_sentinal->_is_sentinal = true;
-		_sentinal->_count = 0;
+		_sentinal = create_sentinal();
 		_root = _sentinal;
+		_rightmost = _sentinal;
 	}
 
 	RBTree(const RBTree &other) : _node_alloc(other._node_alloc),
 									_val_alloc(other._val_alloc),
-									_comp(other._comp)
+									_comp(other._comp),
+									_size(0)
 	{
-		_sentinal = create_node(value_type()) ;
-		_sentinal->_parent = _sentinal;
-		_sentinal->_color = 0;
-		_sentinal->_left = _sentinal;
-		_sentinal->_right = _sentinal;
-		_sentinal->_is_sentinal = true;
+		_sentinal = create_sentinal();
 		_root = _sentinal;
-		if (other.size() == 0)
-			return ;
-		// _root = replicate(_root, other._root);
-		const_iterator it = other.begin();
-		while (it != other.end())
-		{
-			insert(*it);
-			it++;
-		}
-		_size = other.size();
-		// std::cout << "RAN " << _root->_is_sentinal << std::endl;
+		_rightmost = _sentinal;
+		clone_from(other);
 	}
 
 	RBTree& operator=( const RBTree& other )
     {
-		if (_size > 0)
-			clear(get_root());
-		_size = other._size;
-		if (other._root == other._sentinal)
+		if (this == &other)
 			return (*this);
-		replicate(_root, other._root);
+		if (_size > 0)
+			clear();
+		_comp = other._comp;
+		clone_from(other);
 		return (*this);
-		// _root = _sentinal;
-		// _val_alloc = other._val_alloc;
-		// _comp = other._comp;
-		// _size = other._size;
-        // _node_alloc = other._node_alloc;
-
-		// if (other.size() == 0)
-		// 	return (*this);
-		// _root = replicate(_root, other._root);
-		// _sentinal->_right = _root;
-		// _sentinal->_left = _root;
-		// prettyPrint();
-		// std::cout << "ROOT SEN: " << _root->_is_sentinal << std::endl;
-		// std::cout << "OTHER ROOT SEN: " << other._root->_is_sentinal << std::endl;
-		// // other.prettyPrint();
     } 
 
+	// O(n) structural copy of an other tree into this empty one: colors
+	// and _count come along, so nothing is compared or rebalanced.
+	// With threads > 1 the top levels hand one subtree to a new thread.
+	void clone_from(const RBTree &other, unsigned threads = 1)
+	{
+		unsigned depth = 0;
+
+		while ((1u << depth) < threads)
+			depth++;
+		_root = clone_subtree(other._root, _sentinal, depth);
+		_size = other._size;
+		_sentinal->_left = _root;
+		_sentinal->_right = _root;
+		_rightmost = max(_root);
+	}
+
+	// O(n) build of this empty tree from the strictly increasing values
+	// in [first, last): the middle value becomes the root, every complete
+	// level is black and an incomplete bottom level red, so nothing is
+	// compared or rebalanced.
+	template <class It>
+	void build_sorted(It first, It last)
+	{
+		size_t n = std::distance(first, last);
+		size_t full = 0;
+
+		// depth of the deepest level that is completely filled
+		while ((size_t(2) << full) - 1 <= n)
+			full++;
+		_root = build_subtree(first, n, 0, (size_t(1) << full) - 1 == n ? size_t(-1) : full, _sentinal);
+		_size = n;
+		_sentinal->_left = _root;
+		_sentinal->_right = _root;
+		_rightmost = max(_root);
+	}
+
+	// builds the next n values of it in order, left subtree first, so a
+	// forward iterator is walked once
+	template <class It>
+	node_pointer build_subtree(It &it, size_t n, size_t depth, size_t red_depth, node_pointer parent)
+	{
+		node_pointer node;
+		node_pointer left;
+		size_t half = n / 2;
+
+		if (n == 0)
+			return (_sentinal);
+		left = build_subtree(it, half, depth + 1, red_depth, nullptr);
+		node = create_node(*it);
+		++it;
+		node->_parent = parent;
+		node->_color = depth == red_depth ? 1 : 0;
+		node->_count = n;
+		node->_left = left;
+		if (!left->_is_sentinal)
+			left->_parent = node;
+		node->_right = build_subtree(it, n - half - 1, depth + 1, red_depth, node);
+		return (node);
+	}
+
+	node_pointer clone_subtree(node_pointer src, node_pointer parent, unsigned depth)
+	{
+		node_pointer node;
+
+		if (src->_is_sentinal)
+			return (_sentinal);
+		node = copy_node(src);
+		node->_parent = parent;
+		if (depth > 0 && src->_count >= parallel_clone_min)
+		{
+			std::future<node_pointer> left = std::async(std::launch::async,
+				&RBTree::clone_subtree, this, src->_left, node, depth - 1);
+
+			node->_right = clone_subtree(src->_right, node, depth - 1);
+			node->_left = left.get();
+		}
+		else
+		{
+			node->_left = clone_subtree(src->_left, node, 0);
+			node->_right = clone_subtree(src->_right, node, 0);
+		}
+		return (node);
+	}
+
 	//destructor
 	~RBTree()
 	{
 		if (_size > 0)
 			clear();
-		delete_node(_sentinal);
+		delete_sentinal(_sentinal);
 	}
 
 	// find the node with the min key
@@ -196,19 +272,21 @@ public:
 
 	node_pointer	find_val(node_pointer node, const value_type &val) const
 	{
-		// std::cout << "IN" << std::endl;
-		if (node->_is_sentinal)
-			return node;
-		if (_comp(val, *node->_data))
-			return find_val(node->_left, val);
-		if (_comp(*node->_data, val))
-			return find_val(node->_right, val);
+		while (!node->_is_sentinal)
+		{
+			if (_comp(val, node->data()))
+				node = node->_left;
+			else if (_comp(node->data(), val))
+				node = node->_right;
+			else
+				break;
+		}
 		return node;
 	}
 
 	void preOrderHelper(node_pointer node) {
 		if (node != _sentinal) {
-			std::cout<<node->_data<<" ";
+			std::cout<<node->data().first<<" ";
 			preOrderHelper(node->_left);
 			preOrderHelper(node->_right);
 		} 
@@ -217,7 +295,7 @@ public:
 	void inOrderHelper(node_pointer node) {
 		if (node != _sentinal) {
 			inOrderHelper(node->_left);
-			std::cout<<node->data<<" ";
+			std::cout<<node->data().first<<" ";
 			inOrderHelper(node->_right);
 		} 
 	}
@@ -226,7 +304,7 @@ public:
 		if (node != _sentinal) {
 			postOrderHelper(node->_left);
 			postOrderHelper(node->_right);
-			std::cout<<node->data<<" ";
+			std::cout<<node->data().first<<" ";
 		} 
 	}
 
@@ -274,7 +352,7 @@ public:
 					s = x->_parent->_left;
 				}
 
-				if (s->_right->_color == 0 && s->_right->_color == 0) {
+				if (s->_right->_color == 0 && s->_left->_color == 0) {
 					// case 3.2
 					s->_color = 1;
 					x = x->_parent;
@@ -383,37 +461,37 @@ public:
 	}
 
 	// find the successor of a given node
-	node_pointer successor(node_pointer x) {
+	node_pointer successor(node_pointer x) const {
 		// if the right subtree is not null,
 		// the successor is the leftmost node in the
 		// right subtree
-		if (x->right != _sentinal) {
-			return min(x->right);
+		if (!x->_right->_is_sentinal) {
+			return min(x->_right);
 		}
 
 		// else it is the lowest ancestor of x whose
 		// left child is also an ancestor of x.
-		node_pointer y = x->parent;
-		while (y != _sentinal && x == y->right) {
+		node_pointer y = x->_parent;
+		while (!y->_is_sentinal && x == y->_right) {
 			x = y;
-			y = y->parent;
+			y = y->_parent;
 		}
 		return y;
 	}
 
 	// find the predecessor of a given node
-	node_pointer predecessor(node_pointer x) {
+	node_pointer predecessor(node_pointer x) const {
 		// if the left subtree is not null,
 		// the predecessor is the rightmost node in the 
 		// left subtree
-		if (x->left != _sentinal) {
-			return max(x->left);
+		if (!x->_left->_is_sentinal) {
+			return max(x->_left);
 		}
 
-		node_pointer y = x->parent;
-		while (y != _sentinal && x == y->left) {
+		node_pointer y = x->_parent;
+		while (!y->_is_sentinal && x == y->_left) {
 			x = y;
-			y = y->parent;
+			y = y->_parent;
 		}
 
 		return y;
@@ -468,26 +546,126 @@ public:
 		return (node->_index + search_node(node->left) + search_node(node->right));
 	}
 
+	node_pointer insert(const value_type &val) {
+		return (insert_node(create_node(val)));
+	}
+
+	node_pointer insert(value_type &&val) {
+		return (insert_node(create_node(std::move(val))));
+	}
+
+	// walk down once: returns the node already holding val's key, or the
+	// sentinal with parent/is_left telling where val belongs
+	node_pointer find_slot(const value_type &val, node_pointer &parent, bool &is_left) const {
+		node_pointer x = _root;
+
+		parent = _sentinal;
+		is_left = false;
+		while (!x->_is_sentinal)
+		{
+			parent = x;
+			if (_comp(val, x->data()))
+			{
+				is_left = true;
+				x = x->_left;
+			}
+			else if (_comp(x->data(), val))
+			{
+				is_left = false;
+				x = x->_right;
+			}
+			else
+				return (x);
+		}
+		return (x);
+	}
+
+	ft::pair<node_pointer, bool> insert_unique(const value_type &val) {
+		node_pointer parent;
+		bool is_left;
+		node_pointer found = find_slot(val, parent, is_left);
+
+		if (!found->_is_sentinal)
+			return (ft::pair<node_pointer, bool>(found, false));
+		return (ft::pair<node_pointer, bool>(link_node(create_node(val), parent, is_left), true));
+	}
+
+	ft::pair<node_pointer, bool> insert_unique(value_type &&val) {
+		node_pointer parent;
+		bool is_left;
+		node_pointer found = find_slot(val, parent, is_left);
+
+		if (!found->_is_sentinal)
+			return (ft::pair<node_pointer, bool>(found, false));
+		return (ft::pair<node_pointer, bool>(link_node(create_node(std::move(val)), parent, is_left), true));
+	}
+
+	// build the value inside a fresh node, then keep it only if the key
+	// is not in the tree yet
+	template <class... Args>
+	ft::pair<node_pointer, bool> emplace_unique(Args&&... args) {
+		node_pointer new_node = create_node(std::forward<Args>(args)...);
+		node_pointer parent;
+		bool is_left;
+		node_pointer found = find_slot(new_node->data(), parent, is_left);
+
+		if (!found->_is_sentinal)
+		{
+			delete_node(new_node);
+			return (ft::pair<node_pointer, bool>(found, false));
+		}
+		return (ft::pair<node_pointer, bool>(link_node(new_node, parent, is_left), true));
+	}
+
+	// insert next to hint without a descent when val belongs right before
+	// or right after it, otherwise fall back to insert_unique
+	template <class V>
+	ft::pair<node_pointer, bool> insert_hint(node_pointer hint, V &&val) {
+		if (hint->_is_sentinal)
+		{
+			if (_size > 0 && _comp(_rightmost->data(), val))
+				return (ft::pair<node_pointer, bool>(link_node(create_node(std::forward<V>(val)), _rightmost, false), true));
+		}
+		else if (_comp(val, hint->data()))
+		{
+			node_pointer prev = predecessor(hint);
+
+			if (prev->_is_sentinal || _comp(prev->data(), val))
+			{
+				if (hint->_left->_is_sentinal)
+					return (ft::pair<node_pointer, bool>(link_node(create_node(std::forward<V>(val)), hint, true), true));
+				return (ft::pair<node_pointer, bool>(link_node(create_node(std::forward<V>(val)), prev, false), true));
+			}
+		}
+		else if (_comp(hint->data(), val))
+		{
+			node_pointer next = successor(hint);
+
+			if (next->_is_sentinal || _comp(val, next->data()))
+			{
+				if (hint->_right->_is_sentinal)
+					return (ft::pair<node_pointer, bool>(link_node(create_node(std::forward<V>(val)), hint, false), true));
+				return (ft::pair<node_pointer, bool>(link_node(create_node(std::forward<V>(val)), next, true), true));
+			}
+		}
+		else
+			return (ft::pair<node_pointer, bool>(hint, false));
+		return (insert_unique(std::forward<V>(val)));
+	}
+
 	// insert the key to the tree in its appropriate position
 	// and fix the tree
-	node_pointer insert(const value_type &val) {
+	node_pointer insert_node(node_pointer new_node) {
 		// Ordinary Binary Search Insertion
-		node_pointer new_node = create_node(val);
-		new_node->_parent = nullptr;
-		new_node->_left = _sentinal;
-		new_node->_right = _sentinal;
-		new_node->_color = 1; // new node must be red
-		new_node->_count = 1;
 		node_pointer y = _sentinal;
 		node_pointer x = _root;
-		// std::cout << "root count" << _root->_count << std::endl;
-		// std::cout << "root left count" << _root->_left->_count << std::endl;
-		// std::cout << "root right count" << _root->_right->_count << std::endl;
+		bool is_left = false;
+
 		while (!x->_is_sentinal)
         {
 			y = x;
-			x->_count++;
-			if (_comp(*new_node->_data, *x->_data))
+			is_left = _comp(new_node->data(), x->data());
+			if (is_left)
             {
 				x = x->_left;
 			}
@@ -496,18 +674,31 @@ public:
 				x = x->_right;
 			}
 		}
+		return (link_node(new_node, y, is_left));
+	}
+
+	// hang new_node under y, bump the counts on its path and fix the tree
+	node_pointer link_node(node_pointer new_node, node_pointer y, bool is_left) {
+		new_node->_left = _sentinal;
+		new_node->_right = _sentinal;
+		new_node->_color = 1; // new node must be red
+		new_node->_count = 1;
 
 		// y is parent of x
 		new_node->_parent = y;
+		if (y->_is_sentinal || (y == _rightmost && !is_left))
+			_rightmost = new_node;
 		if (y->_is_sentinal) {
 			_root = new_node;
 			_sentinal->_right = _root;
 			_sentinal->_left = _root;
-		} else if (_comp(*new_node->_data, *y->_data)) {
+		} else if (is_left) {
 			y->_left = new_node;
 		} else {
 			y->_right = new_node;
 		}
+		for (node_pointer p = y; !p->_is_sentinal; p = p->_parent)
+			p->_count++;
 
 		// if new node is a _root node, simply return
 		_size++;
@@ -528,8 +719,7 @@ public:
 
 	void delete_node(node_pointer node)
 	{
-		_val_alloc.destroy((node->_data));
-		_val_alloc.deallocate((node->_data), 1);
+		_val_alloc.destroy(&node->data());
 		_node_alloc.destroy(node);
 		_node_alloc.deallocate(node, 1);
 	}
@@ -567,6 +757,10 @@ public:
 		if (to_delete == _sentinal) {
 			return;
 		}
+		// the greatest node has at most a red leaf on its left, so this
+		// is O(1)
+		if (to_delete == _rightmost)
+			_rightmost = predecessor(to_delete);
 
 		y = to_delete;
 		int y_original_color = y->_color;
@@ -593,6 +787,8 @@ public:
 			y->_left->_parent = y;
 			y->_color = to_delete->_color;
 		}
+		// every changed subtree hangs on the path from x up to the root
+		update_count(x->_parent);
 		delete_node(to_delete);
 		_size--;
 		if (y_original_color == 0)
@@ -606,24 +802,42 @@ public:
 			_sentinal->_is_sentinal = true;
 			_root = _sentinal;
 		}
+		_sentinal->_left = _root;
+		_sentinal->_right = _root;
 	}
 
-	node_pointer findByIndex(node_pointer node, size_t index) {
-		if (!node)
-			return nullptr;
-		
-		size_t leftCount = (node->_left) ? node->_left->_count : 0;
-        if (index < leftCount)
-            return findByIndex(node->_left, index);
-        else if (index == leftCount)
-            return node;
-        else
-            return findByIndex(node->_right, index - leftCount - 1);
+	void update_count(node_pointer node)
+	{
+		while (!node->_is_sentinal)
+		{
+			node->_count = node->_left->_count + node->_right->_count + 1;
+			node = node->_parent;
+		}
 	}
 
-	void deleteNode(key_type key)
+	// the sentinal is returned when index is past the end
+	node_pointer findByIndex(node_pointer node, size_t index) const {
+		while (!node->_is_sentinal)
+		{
+			size_t leftCount = node->_left->_count;
+
+			if (index < leftCount)
+				node = node->_left;
+			else if (index == leftCount)
+				break;
+			else
+			{
+				index -= leftCount + 1;
+				node = node->_right;
+			}
+		}
+		return node;
+	}
+
+	template <class KeyCompare>
+	void deleteNode(const key_type &key, KeyCompare key_comp)
 	{
-		node_pointer val = find_key(key);
+		node_pointer val = find_key(key, key_comp);
 		if (!val->_is_sentinal)
 			deleteNodeHelper(val);
 	}
@@ -636,8 +850,19 @@ public:
 	}
 
 	void printHelper(node_pointer node, std::string indent, bool last) const {
-		// print the tree structure on the screen
-	   	if (!node->_is_sentinal) {
+		// print the tree structure on the screen, depth first with an
+		// explicit stack so deep trees cannot overflow the call stack
+		std::vector<ft::pair<node_pointer, ft::pair<std::string, bool> > > todo;
+
+		todo.push_back(ft::make_pair(node, ft::make_pair(indent, last)));
+		while (!todo.empty())
+		{
+			node = todo.back().first;
+			indent = todo.back().second.first;
+			last = todo.back().second.second;
+			todo.pop_back();
+			if (node->_is_sentinal)
+				continue;
 		   std::cout<<indent;
 		   if (last) {
 		      std::cout << "R----";
@@ -648,11 +873,10 @@ public:
 		   }
             
            std::string color = node->_color ? "RED" : "BLACK";
-		   std::cout<<node->_data->first << ":" << node->_data->second << " " << "(" << color << ")" << std::endl;
-		   printHelper(node->_left, indent, false);
-		   printHelper(node->_right, indent, true);
+		   std::cout<<node->data().first << ":" << node->data().second << " " << "(" << color << ")" << std::endl;
+		   todo.push_back(ft::make_pair(node->_right, ft::make_pair(indent, true)));
+		   todo.push_back(ft::make_pair(node->_left, ft::make_pair(indent, false)));
 		}
-		// std::cout<<root->left->data<<std::endl;
 	}
 
 	void prettyPrint() const {
@@ -662,16 +886,160 @@ public:
 	    }
 	}
 
-	node_pointer find_key(key_type key) const
+	template <class KeyCompare>
+	node_pointer find_key(const key_type &key, KeyCompare key_comp) const
 	{
-		node_pointer node;
+		node_pointer node = lower_bound_key(key, key_comp);
 
-		value_type val(key, mapped_type());
-
-		node = find_val(_root, val);
+		if (!node->_is_sentinal && key_comp(key, node->data().first))
+			return (_sentinal);
 		return (node);
 	}
 
+	// first node whose value is not less than val, or the sentinal
+	node_pointer lower_bound(const value_type &val) const
+	{
+		node_pointer node = _root;
+		node_pointer res = _sentinal;
+
+		while (!node->_is_sentinal)
+		{
+			if (_comp(node->data(), val))
+				node = node->_right;
+			else
+			{
+				res = node;
+				node = node->_left;
+			}
+		}
+		return (res);
+	}
+
+	// first node whose value is greater than val, or the sentinal
+	node_pointer upper_bound(const value_type &val) const
+	{
+		node_pointer node = _root;
+		node_pointer res = _sentinal;
+
+		while (!node->_is_sentinal)
+		{
+			if (_comp(val, node->data()))
+			{
+				res = node;
+				node = node->_left;
+			}
+			else
+				node = node->_right;
+		}
+		return (res);
+	}
+
+	// number of values ordered before val, its lower_bound rank
+	size_t count_less(const value_type &val) const
+	{
+		node_pointer node = _root;
+		size_t rank = 0;
+
+		while (!node->_is_sentinal)
+		{
+			if (_comp(node->data(), val))
+			{
+				rank += node->_left->_count + 1;
+				node = node->_right;
+			}
+			else
+				node = node->_left;
+		}
+		return (rank);
+	}
+
+	// The *_key lookups descend on the key alone with the map's key
+	// comparator, so no value_type (and no mapped_type) is built for them.
+
+	// find_slot on the key alone
+	template <class KeyCompare>
+	node_pointer find_slot_key(const key_type &key, KeyCompare key_comp, node_pointer &parent, bool &is_left) const
+	{
+		node_pointer x = _root;
+
+		parent = _sentinal;
+		is_left = false;
+		while (!x->_is_sentinal)
+		{
+			parent = x;
+			if (key_comp(key, x->data().first))
+			{
+				is_left = true;
+				x = x->_left;
+			}
+			else if (key_comp(x->data().first, key))
+			{
+				is_left = false;
+				x = x->_right;
+			}
+			else
+				return (x);
+		}
+		return (x);
+	}
+
+	template <class KeyCompare>
+	node_pointer lower_bound_key(const key_type &key, KeyCompare key_comp) const
+	{
+		node_pointer node = _root;
+		node_pointer res = _sentinal;
+
+		while (!node->_is_sentinal)
+		{
+			if (key_comp(node->data().first, key))
+				node = node->_right;
+			else
+			{
+				res = node;
+				node = node->_left;
+			}
+		}
+		return (res);
+	}
+
+	template <class KeyCompare>
+	node_pointer upper_bound_key(const key_type &key, KeyCompare key_comp) const
+	{
+		node_pointer node = _root;
+		node_pointer res = _sentinal;
+
+		while (!node->_is_sentinal)
+		{
+			if (key_comp(key, node->data().first))
+			{
+				res = node;
+				node = node->_left;
+			}
+			else
+				node = node->_right;
+		}
+		return (res);
+	}
+
+	template <class KeyCompare>
+	size_t count_less_key(const key_type &key, KeyCompare key_comp) const
+	{
+		node_pointer node = _root;
+		size_t rank = 0;
+
+		while (!node->_is_sentinal)
+		{
+			if (key_comp(node->data().first, key))
+			{
+				rank += node->_left->_count + 1;
+				node = node->_right;
+			}
+			else
+				node = node->_left;
+		}
+		return (rank);
+	}
+
 	node_pointer get_sentinal() const
 	{
 		return _sentinal;
@@ -679,47 +1047,46 @@ public:
 
 	void clear()
 	{
-		rec_del_node(_root);
+		destroy_subtree(_root);
 		_sentinal->_color = 0;
 		_sentinal->_is_sentinal = true;
 		_sentinal->_parent = _sentinal;
 		_sentinal->_left = _sentinal;
 		_sentinal->_right = _sentinal;
 		_root = _sentinal;
+		_rightmost = _sentinal;
 		_size = 0;
 	}
-	
-	void rec_del_node(node_pointer node)
-	{
-		if (node->_is_sentinal)
-			return;
-		rec_del_node(node->_right);
-		rec_del_node(node->_left);
-		delete_node(node);
-	}
 
-	node_pointer replicate(node_pointer node, node_pointer src_node)
+	// free a whole subtree with O(1) extra space: rotate right until the
+	// top has no left child, then free it and continue with its right.
+	// Parent links and counts are not kept since every node goes away.
+	void destroy_subtree(node_pointer node)
 	{
-		if (src_node->_is_sentinal)
-			return node;
-		std::cout << "ran" << std::endl;
-		node = copy_node(src_node);
-		// std::cout << "copied one node is sen: " << node->_is_sentinal << std::endl;
-		if (!src_node->_left->_is_sentinal) {
-			replicate(node->_left, src_node->_left);
-			node->_left->_parent = node;
-		}
-		if (!src_node->_right->_is_sentinal) {
-			replicate(node->_right, src_node->_right);
-			node->_right->_parent = node;
+		node_pointer next;
+
+		while (!node->_is_sentinal)
+		{
+			if (!node->_left->_is_sentinal)
+			{
+				next = node->_left;
+				node->_left = next->_right;
+				next->_right = node;
+			}
+			else
+			{
+				next = node->_right;
+				delete_node(node);
+			}
+			node = next;
 		}
-		return node;
 	}
 
 	void swap_tree(RBTree &other)
 	{
 		node_pointer temp_root(other._root);
 		node_pointer temp_sentinal(other._sentinal);
+		node_pointer temp_rightmost(other._rightmost);
 		node_allocator temp_node_alloc(other._node_alloc);
 		allocator_type temp_val_alloc(other._val_alloc);
 		value_comp temp_comp(other._comp);
@@ -727,6 +1094,7 @@ public:
 
 		other._root = _root;
 		other._sentinal = _sentinal;
+		other._rightmost = _rightmost;
 		other._node_alloc = _node_alloc;
 		other._val_alloc = _val_alloc;
 		other._comp = _comp;
@@ -734,6 +1102,7 @@ public:
 
 		_root = temp_root;
 		_sentinal = temp_sentinal;
+		_rightmost = temp_rightmost;
 		_node_alloc = temp_node_alloc;
 		_val_alloc = temp_val_alloc;
 		_comp = temp_comp;
@@ -1,33 +1,191 @@
 // Implementing Red-Black Tree in C++
 
+#ifndef RBTC_HPP
+# define RBTC_HPP
+
 #include <iostream>
 using namespace std;
-#include <stack>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
 
 enum Color { BLACK = 0, RED = 1 };
 
+template <class Key>
 struct Node {
-  string data;
+  Key data;
   Node *parent;
   Node *left;
   Node *right;
   enum Color color;
   size_t count;
+
+  template <class... Args>
+  explicit Node(Args &&... args) : data(std::forward<Args>(args)...) {}
+};
+
+// Fixed-width byte string key (hashes, packed ids). Ordered like memcmp,
+// but compared a machine word at a time, see less<fixed_key<N> > below.
+template <size_t N>
+struct fixed_key {
+  unsigned char bytes[N];
+};
+
+template <size_t N>
+bool operator==(const fixed_key<N> &a, const fixed_key<N> &b) {
+  return memcmp(a.bytes, b.bytes, N) == 0;
+}
+
+template <size_t N>
+bool operator<(const fixed_key<N> &a, const fixed_key<N> &b) {
+  return less<fixed_key<N> >()(a, b);
+}
+
+namespace std {
+template <size_t N>
+struct less<fixed_key<N> > {
+  bool operator()(const fixed_key<N> &a, const fixed_key<N> &b) const {
+    size_t i = 0;
+    // big-endian word loads keep memcmp order with one compare per 8 bytes
+    for (; i + 8 <= N; i += 8) {
+      uint64_t x, y;
+      memcpy(&x, a.bytes + i, 8);
+      memcpy(&y, b.bytes + i, 8);
+      if (x != y) {
+        return __builtin_bswap64(x) < __builtin_bswap64(y);
+      }
+    }
+    return memcmp(a.bytes + i, b.bytes + i, N - i) < 0;
+  }
+};
+}
+
+// How keys are handed to lookups: scalars (ids, timestamps) and small
+// fixed keys travel in registers, everything else by const reference.
+// heapBytes is where a key keeps bytes outside its node, for descents
+// to prefetch; nullptr when it has none.
+template <class Key>
+struct key_traits {
+  typedef typename conditional<is_scalar<Key>::value, Key, const Key &>::type arg_type;
+
+  static const void *heapBytes(const Key &) { return nullptr; }
+};
+
+template <size_t N>
+struct key_traits<fixed_key<N> > {
+  typedef typename conditional<(N <= 16), fixed_key<N>, const fixed_key<N> &>::type arg_type;
+
+  static const void *heapBytes(const fixed_key<N> &) { return nullptr; }
 };
 
-typedef Node *NodePtr;
+template <>
+struct key_traits<string> {
+  typedef const string &arg_type;
+
+  static const void *heapBytes(const string &key) { return key.data(); }
+};
 
+// Default for RedBlackTree::setPrefetch: 0 no prefetching, 1 both
+// children of every node a descent passes, 2 also the grandchildren and
+// the children's key bytes. Off by default: the next address still
+// depends on the current load, and make bench showed no steady gain.
+#ifndef RBTC_PREFETCH
+# define RBTC_PREFETCH 0
+#endif
+
+// Whether trees taking nodes from Alloc are walked by lock-free readers
+// while a writer changes them, as in concurrent_storage. Such trees store
+// links, parents, counts and the root as atomic release stores, so a
+// reader that loads a link with acquire also sees the node behind it as
+// it was written; every other tree keeps plain stores.
+template <class Alloc>
+struct concurrent_reads : false_type {};
+
+template <class Key, class Compare = less<Key>, class Alloc = allocator<Key> >
 class RedBlackTree {
+   public:
+  typedef Node<Key> NodeType;
+  typedef NodeType *NodePtr;
+  typedef typename key_traits<Key>::arg_type KeyArg;
+  typedef typename Alloc::template rebind<NodeType>::other NodeAlloc;
+
    private:
   NodePtr root;
   NodePtr TNULL;
+  Compare comp;
+  NodeAlloc nodeAlloc;
+  int prefetchDepth;
+
+  template <class... Args>
+  NodePtr createNode(Args &&... args) {
+    NodePtr node = nodeAlloc.allocate(1);
+    nodeAlloc.construct(node, std::forward<Args>(args)...);
+    return node;
+  }
 
-  void initializeNULLNode(NodePtr node, NodePtr parent) {
-    node->data = "";
-    node->parent = parent;
-    node->left = TNULL;
-    node->right = TNULL;
+  // every store to a link, parent, count or the root, see
+  // concurrent_reads
+  template <class T>
+  static void store(T &field, typename common_type<T>::type value) {
+    if (concurrent_reads<Alloc>::value) {
+      __atomic_store_n(&field, value, __ATOMIC_RELEASE);
+    } else {
+      field = value;
+    }
+  }
+
+  void destroyNode(NodePtr node) {
+    nodeAlloc.destroy(node);
+    nodeAlloc.deallocate(node, 1);
+  }
+
+  static NodePtr initializeNULLNode(NodePtr node) {
+    store(node->parent, node);
+    store(node->left, node);
+    store(node->right, node);
     node->color = BLACK;
+    store(node->count, 0);
+    return node;
+  }
+
+  // One leaf sentinel per tree type, shared by all trees and never
+  // written after set up. Whole subtrees can therefore move between
+  // trees, and trees used from different threads share no dirty line.
+  static NodePtr nullNode() {
+    static NodeType node;
+    static NodePtr ptr = initializeNULLNode(&node);
+    return ptr;
+  }
+
+  // Descents wait on every child load in turn. Requesting the next one
+  // or two levels while the current node is compared overlaps those
+  // misses; prefetches of TNULL or nullptr are harmless.
+  void prefetchBelow(NodePtr node, bool keys) const {
+    if (prefetchDepth < 1) {
+      return;
+    }
+    NodePtr l = node->left;
+    NodePtr r = node->right;
+    __builtin_prefetch(l);
+    __builtin_prefetch(r);
+    if (prefetchDepth < 2) {
+      return;
+    }
+    // l and r were requested one level up, so these reads rarely stall
+    __builtin_prefetch(l->left);
+    __builtin_prefetch(l->right);
+    __builtin_prefetch(r->left);
+    __builtin_prefetch(r->right);
+    if (keys) {
+      __builtin_prefetch(key_traits<Key>::heapBytes(l->data));
+      __builtin_prefetch(key_traits<Key>::heapBytes(r->data));
+    }
   }
 
   // Preorder
@@ -57,81 +215,367 @@ class RedBlackTree {
     }
   }
 
-  NodePtr searchTreeHelper(NodePtr node, string key) {
-    if (node == TNULL || key == node->data) {
-      return node;
-    }
-
-    if (key < node->data) {
-      return searchTreeHelper(node->left, key);
+  NodePtr searchTreeHelper(NodePtr node, KeyArg key) {
+    while (node != TNULL) {
+      if (comp(key, node->data)) {
+        node = node->left;
+      } else if (comp(node->data, key)) {
+        node = node->right;
+      } else {
+        break;
+      }
     }
-    return searchTreeHelper(node->right, key);
+    return node;
   }
 
-  // For balancing the tree after deletion
-  void deleteFix(NodePtr x) {
-    // std::cout << "deleteFix" << std::endl;
+  // For balancing the tree after deletion. x may be TNULL, so its
+  // parent is tracked in xp instead of being stored in the sentinel.
+  void deleteFix(NodePtr x, NodePtr xp) {
     NodePtr s;
-    // if (x == root)
-    //   x->count = 1;
     while (x != root && x->color == BLACK) {
-      if (x == x->parent->left) {
-        s = x->parent->right;
+      if (x == xp->left) {
+        s = xp->right;
         if (s->color == RED) {
           s->color = BLACK;
-          x->parent->color = RED;
-          // std::cout << "this one" << std::endl;
-          leftRotate(x->parent);
-          s = x->parent->right;
+          xp->color = RED;
+          leftRotate(xp);
+          s = xp->right;
         }
 
         if (s->left->color == BLACK && s->right->color == BLACK) {
           s->color = RED;
-          x = x->parent;
+          x = xp;
+          xp = xp->parent;
         } else {
           if (s->right->color == BLACK) {
             s->left->color = BLACK;
             s->color = RED;
             rightRotate(s);
-            s = x->parent->right;
-            // s->count = rightCount(s) + ()
+            s = xp->right;
           }
 
-          s->color = x->parent->color;
-          x->parent->color = BLACK;
+          s->color = xp->color;
+          xp->color = BLACK;
           s->right->color = BLACK;
-          leftRotate(x->parent);
+          leftRotate(xp);
           x = root;
         }
       } else {
-        s = x->parent->left;
+        s = xp->left;
         if (s->color == RED) {
           s->color = BLACK;
-          x->parent->color = RED;
-          rightRotate(x->parent);
-          s = x->parent->left;
+          xp->color = RED;
+          rightRotate(xp);
+          s = xp->left;
         }
 
         if (s->right->color == BLACK && s->left->color == BLACK) {
           s->color = RED;
-          x = x->parent;
+          x = xp;
+          xp = xp->parent;
         } else {
           if (s->left->color == BLACK) {
             s->right->color = BLACK;
             s->color = RED;
             leftRotate(s);
-            s = x->parent->left;
+            s = xp->left;
           }
 
-          s->color = x->parent->color;
-          x->parent->color = BLACK;
+          s->color = xp->color;
+          xp->color = BLACK;
           s->left->color = BLACK;
-          rightRotate(x->parent);
+          rightRotate(xp);
           x = root;
         }
       }
     }
-    x->color = BLACK;
+    if (x != TNULL) {
+      x->color = BLACK;
+    }
+  }
+
+  // Frees every node with O(1) extra space: rotate right until the top
+  // has no left child, free it, continue with its right subtree.
+  void destroySubtree(NodePtr node) {
+    NodePtr next;
+
+    while (node != TNULL) {
+      if (node->left != TNULL) {
+        next = node->left;
+        store(node->left, next->right);
+        store(next->right, node);
+      } else {
+        next = node->right;
+        destroyNode(node);
+      }
+      node = next;
+    }
+  }
+
+  size_t subtreeCount(NodePtr x) {
+    return x == TNULL ? 0 : x->count;
+  }
+
+  // Black nodes from x down to a leaf, x counted as black: the black
+  // height x has as the root of a tree of its own. Walks one path, so
+  // the split and join helpers take it once per whole tree and then
+  // carry it along instead of asking again.
+  size_t blackHeight(NodePtr x) {
+    size_t h = x != TNULL && x->color == RED;
+
+    for (; x != TNULL; x = x->left) {
+      h += x->color == BLACK;
+    }
+    return h;
+  }
+
+  // blackHeight of child c given its parent's; O(1)
+  static size_t childHeight(NodePtr c, size_t parentHeight) {
+    return parentHeight - (c->color == BLACK);
+  }
+
+  // Joins the detached subtrees l < k < r, of black heights hl and hr,
+  // into one red-black tree, returns its root and sets h to its black
+  // height. The shorter tree is hung below the first black node of
+  // matching black height on the taller tree's inner spine, so the work
+  // is O(|hl - hr| + 1).
+  NodePtr joinTrees(NodePtr l, size_t hl, NodePtr k, NodePtr r, size_t hr, size_t &h) {
+    if (l != TNULL) {
+      l->color = BLACK;
+    }
+    if (r != TNULL) {
+      r->color = BLACK;
+    }
+
+    k->color = RED;
+    if (hl == hr) {
+      h = hl + 1;
+      k->color = BLACK;
+      store(k->parent, TNULL);
+      store(k->left, l);
+      store(k->right, r);
+      if (l != TNULL) {
+        store(l->parent, k);
+      }
+      if (r != TNULL) {
+        store(r->parent, k);
+      }
+      store(k->count, subtreeCount(l) + subtreeCount(r) + 1);
+      return k;
+    }
+
+    NodePtr saved = root;
+    NodePtr x, p = TNULL;
+    if (hl > hr) {
+      store(root, l);
+      for (x = l, h = hl; !(x->color == BLACK && h == hr); x = x->right) {
+        h -= x->color == BLACK;
+        p = x;
+      }
+      store(p->right, k);
+      store(k->left, x);
+      store(k->right, r);
+    } else {
+      store(root, r);
+      for (x = r, h = hr; !(x->color == BLACK && h == hl); x = x->left) {
+        h -= x->color == BLACK;
+        p = x;
+      }
+      store(p->left, k);
+      store(k->left, l);
+      store(k->right, x);
+    }
+    store(k->parent, p);
+    if (k->left != TNULL) {
+      store(k->left->parent, k);
+    }
+    if (k->right != TNULL) {
+      store(k->right->parent, k);
+    }
+    store(k->count, subtreeCount(k->left) + subtreeCount(k->right) + 1);
+    size_t added = subtreeCount(hl > hr ? r : l) + 1;
+    for (NodePtr q = p; q != TNULL; q = q->parent) {
+      store(q->count, q->count + added);
+    }
+    insertFixUp(k);
+    // the taller tree grows by one black level only when the fixup
+    // pushed red up to its root
+    h = max(hl, hr) + (root->color == RED);
+    root->color = BLACK;
+
+    NodePtr joined = root;
+    store(root, saved);
+    return joined;
+  }
+
+  // Splits the detached subtree t of black height ht so that l gets its
+  // first rank keys and r the rest, with black heights hl and hr. Every
+  // node on the search path is re-joined once; the heights of the joined
+  // pieces rise along the path, so the joins add up to O(log n).
+  void splitAtRank(NodePtr t, size_t ht, size_t rank, NodePtr &l, size_t &hl, NodePtr &r, size_t &hr) {
+    if (t == TNULL) {
+      l = TNULL;
+      r = TNULL;
+      hl = 0;
+      hr = 0;
+      return;
+    }
+
+    NodePtr tl = t->left;
+    NodePtr tr = t->right;
+    NodePtr a, b;
+    size_t ha, hb;
+    size_t lc = subtreeCount(tl);
+
+    if (tl != TNULL) {
+      store(tl->parent, TNULL);
+    }
+    if (tr != TNULL) {
+      store(tr->parent, TNULL);
+    }
+    if (rank <= lc) {
+      splitAtRank(tl, childHeight(tl, ht), rank, a, ha, b, hb);
+      l = a;
+      hl = ha;
+      r = joinTrees(b, hb, t, tr, childHeight(tr, ht), hr);
+    } else {
+      splitAtRank(tr, childHeight(tr, ht), rank - lc - 1, a, ha, b, hb);
+      l = joinTrees(tl, childHeight(tl, ht), t, a, ha, hl);
+      r = b;
+      hr = hb;
+    }
+  }
+
+  // Same as splitAtRank, but l gets the keys less than key.
+  void splitAtKey(NodePtr t, size_t ht, KeyArg key, NodePtr &l, size_t &hl, NodePtr &r, size_t &hr) {
+    if (t == TNULL) {
+      l = TNULL;
+      r = TNULL;
+      hl = 0;
+      hr = 0;
+      return;
+    }
+
+    NodePtr tl = t->left;
+    NodePtr tr = t->right;
+    NodePtr a, b;
+    size_t ha, hb;
+
+    if (tl != TNULL) {
+      store(tl->parent, TNULL);
+    }
+    if (tr != TNULL) {
+      store(tr->parent, TNULL);
+    }
+    if (!comp(t->data, key)) {
+      splitAtKey(tl, childHeight(tl, ht), key, a, ha, b, hb);
+      l = a;
+      hl = ha;
+      r = joinTrees(b, hb, t, tr, childHeight(tr, ht), hr);
+    } else {
+      splitAtKey(tr, childHeight(tr, ht), key, a, ha, b, hb);
+      l = joinTrees(tl, childHeight(tl, ht), t, a, ha, hl);
+      r = b;
+      hr = hb;
+    }
+  }
+
+  // Multiset union of two detached subtrees of black heights ha and hb,
+  // setting h to the result's: split b around a's root, merge the halves
+  // and join them back under that root. With the black heights carried
+  // along every split and join is proportional to the heights it spans,
+  // and with a the smaller tree (m keys) this costs O(m log(n/m + 1)).
+  NodePtr unionTrees(NodePtr a, size_t ha, NodePtr b, size_t hb, size_t &h) {
+    if (a == TNULL) {
+      h = hb;
+      return b;
+    }
+    if (b == TNULL) {
+      h = ha;
+      return a;
+    }
+
+    NodePtr al = a->left;
+    NodePtr ar = a->right;
+    NodePtr bl, br;
+    size_t hbl, hbr, hl, hr;
+
+    if (al != TNULL) {
+      store(al->parent, TNULL);
+    }
+    if (ar != TNULL) {
+      store(ar->parent, TNULL);
+    }
+    splitAtKey(b, hb, a->data, bl, hbl, br, hbr);
+    NodePtr l = unionTrees(al, childHeight(al, ha), bl, hbl, hl);
+    NodePtr r = unionTrees(ar, childHeight(ar, ha), br, hbr, hr);
+    return joinTrees(l, hl, a, r, hr, h);
+  }
+
+  // Builds a balanced subtree from n sorted keys starting at first.
+  // Middle splits keep every leaf at depth h or h + 1; nodes on the
+  // incomplete bottom level (redDepth) are red, all others black.
+  template <class It>
+  NodePtr buildSubtree(It first, size_t n, size_t depth, size_t redDepth, NodePtr parent) {
+    if (n == 0) {
+      return TNULL;
+    }
+
+    size_t half = n / 2;
+    NodePtr node = createNode(*(first + half));
+    store(node->parent, parent);
+    node->color = depth == redDepth ? RED : BLACK;
+    store(node->count, n);
+    store(node->left, buildSubtree(first, half, depth + 1, redDepth, node));
+    store(node->right, buildSubtree(first + half + 1, n - half - 1, depth + 1, redDepth, node));
+    return node;
+  }
+
+  template <class It>
+  void findSortedHelper(NodePtr node, size_t base, It origin, It first, It last, NodePtr *out) {
+    while (first != last && node != TNULL) {
+      size_t rank = base + leftCount(node);
+      It mid = lower_bound(first, last, rank);
+      It past = upper_bound(mid, last, rank);
+
+      fill(out + (mid - origin), out + (past - origin), node);
+      findSortedHelper(node->left, base, origin, first, mid, out);
+      base = rank + 1;
+      first = past;
+      node = node->right;
+    }
+    fill(out + (first - origin), out + (last - origin), TNULL);
+  }
+
+  void setRoot(NodePtr node) {
+    store(root, node);
+    if (root != TNULL) {
+      store(root->parent, TNULL);
+      root->color = BLACK;
+    }
+  }
+
+  // takes the whole tree out, leaving this one empty
+  NodePtr detach() {
+    NodePtr whole = root;
+    store(root, TNULL);
+    return whole;
+  }
+
+  // Joins l < r, of black heights hl and hr, without a pivot: the first
+  // node of r is split off and used as one.
+  NodePtr joinTrees(NodePtr l, size_t hl, NodePtr r, size_t hr) {
+    if (r == TNULL) {
+      return l;
+    }
+    if (l == TNULL) {
+      return r;
+    }
+
+    NodePtr pivot, rest;
+    size_t hp, hrest, h;
+    splitAtRank(r, hr, 1, pivot, hp, rest, hrest);
+    return joinTrees(l, hl, pivot, rest, hrest, h);
   }
 
   // return the node count in the left subtree
@@ -147,25 +591,25 @@ class RedBlackTree {
   //                        5          6
   void rbTransplant(NodePtr u, NodePtr v) {
     if (u->parent == TNULL) {
-      root = v;
+      store(root, v);
     } else if (u == u->parent->left) {
-      u->parent->left = v;
+      store(u->parent->left, v);
     } else {
-      u->parent->right = v;
+      store(u->parent->right, v);
+    }
+    if (v != TNULL) {
+      store(v->parent, u->parent);
     }
-    v->parent = u->parent;
-	updateCount(v);
   }
 
-  void deleteNodeHelper(NodePtr node, string key) {
+  void deleteNodeHelper(NodePtr node, KeyArg key) {
     NodePtr z = TNULL;
-    NodePtr x, y;
     while (node != TNULL) {
-      if (node->data == key) {
+      if (!comp(key, node->data) && !comp(node->data, key)) {
         z = node;
       }
 
-      if (node->data <= key) {
+      if (!comp(key, node->data)) {
         node = node->right;
       } else {
         node = node->left;
@@ -176,43 +620,62 @@ class RedBlackTree {
       cout << "Key not found in the tree" << endl;
       return;
     }
+    eraseNode(z);
+  }
 
+  // Unlink z and rebalance, leaving z itself untouched. Every count that
+  // changed lies on the path from x's parent to the root, so one upward
+  // pass fixes them all before deleteFix starts rotating.
+  void unlinkNode(NodePtr z) {
+    NodePtr x, xp, y;
     y = z;
     int y_original_color = y->color;
     if (z->left == TNULL) {
       x = z->right;
+      xp = z->parent;
       rbTransplant(z, z->right);
     } else if (z->right == TNULL) {
       x = z->left;
+      xp = z->parent;
       rbTransplant(z, z->left);
     } else {
       y = minimum(z->right);
       y_original_color = y->color;
       x = y->right;
       if (y->parent == z) {
-        x->parent = y;
+        xp = y;
       } else {
+        xp = y->parent;
         rbTransplant(y, y->right);
-        y->right = z->right;
-        y->right->parent = y;
+        store(y->right, z->right);
+        store(y->right->parent, y);
       }
 
       rbTransplant(z, y);
-      y->left = z->left;
-      y->left->parent = y;
+      store(y->left, z->left);
+      store(y->left->parent, y);
       y->color = z->color;
     }
-    if (z == TNULL || z->parent == TNULL) {
-      // no need to recount
-    }
-    delete z;
+    updateCount(xp);
     if (y_original_color == BLACK) {
-      deleteFix(x);
+      deleteFix(x, xp);
     }
   }
 
+  void eraseNode(NodePtr z) {
+    unlinkNode(z);
+    destroyNode(z);
+  }
+
   // For balancing the tree after insertion
   void insertFix(NodePtr k) {
+    insertFixUp(k);
+    root->color = BLACK;
+  }
+
+  // insertFix without blackening the root at the end, so joinTrees can
+  // see whether red reached it
+  void insertFixUp(NodePtr k) {
     NodePtr u;
     while (k->parent->color == RED) {
       if (k->parent == k->parent->parent->right) {
@@ -253,7 +716,6 @@ class RedBlackTree {
     //     break;
     //   }
     }
-    root->color = BLACK;
   }
 
   void printHelper(NodePtr root, string indent, bool last) {
@@ -275,14 +737,31 @@ class RedBlackTree {
   }
 
    public:
-  RedBlackTree() {
-    TNULL = new Node;
-    TNULL->color = BLACK;
-	TNULL->parent = TNULL;
-    TNULL->left = TNULL;
-    TNULL->right = TNULL;
-	TNULL->count = 0;
-    root = TNULL;
+  RedBlackTree(const Compare &c = Compare(), const Alloc &a = Alloc()) : comp(c), nodeAlloc(a), prefetchDepth(RBTC_PREFETCH) {
+    TNULL = nullNode();
+    store(root, TNULL);
+  }
+
+  RedBlackTree(const RedBlackTree &) = delete;
+  RedBlackTree &operator=(const RedBlackTree &) = delete;
+
+  ~RedBlackTree() {
+    clear();
+  }
+
+  void clear() {
+    destroySubtree(root);
+    store(root, TNULL);
+  }
+
+  size_t size() const {
+    return root->count;
+  }
+
+  // how many levels ahead findByIndex and insert prefetch, see
+  // RBTC_PREFETCH
+  void setPrefetch(int depth) {
+    prefetchDepth = depth;
   }
 
   void preorder() {
@@ -297,7 +776,7 @@ class RedBlackTree {
     postOrderHelper(this->root);
   }
 
-  NodePtr searchTree(string k) {
+  NodePtr searchTree(KeyArg k) {
     return searchTreeHelper(this->root, k);
   }
 
@@ -344,75 +823,84 @@ class RedBlackTree {
 
   void leftRotate(NodePtr x) {
     NodePtr y = x->right;
-    x->right = y->left;
+    store(x->right, y->left);
     if (y->left != TNULL) {
-      y->left->parent = x;
+      store(y->left->parent, x);
     }
-    y->parent = x->parent;
+    store(y->parent, x->parent);
     if (x->parent == TNULL) {
-      this->root = y;
+      store(this->root, y);
     } else if (x == x->parent->left) {
-      x->parent->left = y;
+      store(x->parent->left, y);
     } else {
-      x->parent->right = y;
+      store(x->parent->right, y);
     }
-    y->left = x;
-    x->parent = y;
-    x->count = leftCount(x) + rightCount(x) + 1;
-    y->count = leftCount(y) + rightCount(y) + 1;
+    store(y->left, x);
+    store(x->parent, y);
+    store(x->count, leftCount(x) + rightCount(x) + 1);
+    store(y->count, leftCount(y) + rightCount(y) + 1);
   }
 
   void rightRotate(NodePtr x) {
     NodePtr y = x->left;
-    x->left = y->right;
+    store(x->left, y->right);
     if (y->right != TNULL) {
-      y->right->parent = x;
+      store(y->right->parent, x);
     }
-    y->parent = x->parent;
+    store(y->parent, x->parent);
     if (x->parent == TNULL) {
-      this->root = y;
+      store(this->root, y);
     } else if (x == x->parent->right) {
-      x->parent->right = y;
+      store(x->parent->right, y);
     } else {
-      x->parent->left = y;
+      store(x->parent->left, y);
     }
-    y->right = x;
-    x->parent = y;
-    x->count = leftCount(x) + rightCount(x) + 1;
-    y->count = leftCount(y) + rightCount(y) + 1;
+    store(y->right, x);
+    store(x->parent, y);
+    store(x->count, leftCount(x) + rightCount(x) + 1);
+    store(y->count, leftCount(y) + rightCount(y) + 1);
   }
 
   // Inserting a node
-  void insert(string key) {
-    NodePtr node = new Node;
-    node->data = key;
-    node->left = TNULL;
-    node->right = TNULL;
+  NodePtr insert(const Key &key) {
+    return emplace(key);
+  }
+
+  NodePtr insert(Key &&key) {
+    return emplace(std::move(key));
+  }
+
+  // Builds the key in place inside the new node, so rvalue strings are
+  // handed over without another allocation or byte copy.
+  template <class... Args>
+  NodePtr emplace(Args &&... args) {
+    NodePtr node = createNode(std::forward<Args>(args)...);
+    store(node->left, TNULL);
+    store(node->right, TNULL);
     node->color = RED;
-    node->count = 1;
+    store(node->count, 1);
 
     NodePtr y = TNULL;
     NodePtr x = this->root;
 
     while (x != TNULL) {
+      prefetchBelow(x, true);
       y = x;
-      x->count++;
-      if (node->data < x->data) {
+      store(x->count, x->count + 1);
+      if (comp(node->data, x->data)) {
         x = x->left;
       } else {
         x = x->right;
       }
     }
 
-    node->parent = y;
+    store(node->parent, y);
     if (y == TNULL) {
-      root = node;
-    } else if (node->data < y->data) {
-      y->left = node;
-      updateCount(y);
+      store(root, node);
+    } else if (comp(node->data, y->data)) {
+      store(y->left, node);
     } else {
-      y->right = node;
-      updateCount(y);
+      store(y->right, node);
     }
 
     // if (node->parent == TNULL) {
@@ -425,68 +913,223 @@ class RedBlackTree {
     // }
 
     insertFix(node);
+    return node;
   }
 
   NodePtr getRoot() {
     return this->root;
   }
 
-  void deleteNode(string data) {
+  // where the root pointer lives, for lock-free readers that have to
+  // load it atomically while a writer may be rotating it away
+  const NodePtr *getRootAddress() const {
+    return &this->root;
+  }
+
+  NodePtr getNull() const {
+    return TNULL;
+  }
+
+  void deleteNode(KeyArg data) {
     deleteNodeHelper(this->root, data);
   }
 
-  void reduceCount(NodePtr start) {
-    while (start != TNULL) {
-        start->count--;
-        start = start->parent;
-    }
+  // Unlinks and frees node, which must belong to this tree. Other nodes
+  // keep their addresses, so pointers to them stay valid.
+  void erase(NodePtr node) {
+    eraseNode(node);
   }
 
   void updateCount(NodePtr start) {
     while (start != TNULL) {
-        start->count = leftCount(start) + rightCount(start) + 1;
+        store(start->count, leftCount(start) + rightCount(start) + 1);
         start = start->parent;
     }
   }
 
-  void updatePathCount(stack<NodePtr> path) {
-    NodePtr start;
-    while (path.size() > 0) {
-        start = path.top();
-        path.pop();
-        start->count = leftCount(start) + rightCount(start) + 1;
+  NodePtr findByIndex(NodePtr node, size_t index) {
+    while (node != TNULL) {
+      prefetchBelow(node, false);
+      size_t leftCnt = leftCount(node);
+
+      if (index < leftCnt) {
+        node = node->left;
+      } else if (index == leftCnt) {
+        break;
+      } else {
+        index -= leftCnt + 1;
+        node = node->right;
+      }
+    }
+    return node;
+  }
+
+  // number of keys strictly less than key, i.e. the rank lower_bound
+  // would have
+  size_t countLess(KeyArg key) {
+    NodePtr node = root;
+    size_t rank = 0;
+
+    while (node != TNULL) {
+      if (comp(node->data, key)) {
+        rank += leftCount(node) + 1;
+        node = node->right;
+      } else {
+        node = node->left;
+      }
     }
+    return rank;
   }
 
-  NodePtr findByIndex(NodePtr node, size_t index, stack<NodePtr>& path, bool to_delete = false) {
-		size_t leftCnt = leftCount(node);
+  // number of keys less than or equal to key
+  size_t countLessEqual(KeyArg key) {
+    NodePtr node = root;
+    size_t rank = 0;
 
-    path.push(node);
-		if (leftCnt == index) {
-			return node;
-		}
-		else if (index <= leftCnt) {
-			return findByIndex(node->left, index, path, to_delete);
-		}
-		else {
-			return findByIndex(node->right, index - leftCnt - 1, path, to_delete);
-		}
-	}
+    while (node != TNULL) {
+      if (!comp(key, node->data)) {
+        rank += leftCount(node) + 1;
+        node = node->right;
+      } else {
+        node = node->left;
+      }
+    }
+    return rank;
+  }
 
   NodePtr find(size_t index) {
-    std::stack<NodePtr> path;
+    return findByIndex(getRoot(), index);
+  }
+
+  // Node delta ranks away from node (TNULL outside the tree). Climbs only
+  // until node's subtree covers the target and descends from there, so
+  // nearby ranks cost O(log |delta|) instead of a walk from the root.
+  NodePtr findNear(NodePtr node, ptrdiff_t delta) {
+    while (delta < -ptrdiff_t(leftCount(node)) || delta > ptrdiff_t(rightCount(node))) {
+      NodePtr parent = node->parent;
+
+      if (parent == TNULL) {
+        return TNULL;
+      }
+      if (node == parent->left) {
+        delta -= ptrdiff_t(rightCount(node)) + 1;
+      } else {
+        delta += ptrdiff_t(leftCount(node)) + 1;
+      }
+      node = parent;
+    }
+    return findByIndex(node, size_t(delta + ptrdiff_t(leftCount(node))));
+  }
 
-    return findByIndex(getRoot(), index, path, false);
+  // Resolves the ascending ranks [first, last) in one descent and stores
+  // the node for first[i] in out[i] (TNULL past the end). Ranks that share
+  // a path prefix walk it once instead of once per rank.
+  template <class It>
+  void findSorted(It first, It last, NodePtr *out) {
+    findSortedHelper(root, 0, first, first, last, out);
   }
 
   void deleteByIndex(size_t index) {
-    std::stack<NodePtr> path;
+    NodePtr node = findByIndex(getRoot(), index);
 
-    NodePtr node = findByIndex(getRoot(), index, path, false);
-    reduceCount(node);
-    deleteNodeHelper(node, node->data);
-    path.pop(); // to remove the deleted node
-    updatePathCount(path);
+    if (node != TNULL) {
+      eraseNode(node);
+    }
+  }
+
+  // Erases the keys ranked [first, last). The range is cut out with two
+  // splits, freed in one sweep and the rest joined back, so the cost is
+  // O(log n + k) instead of k separate deletes with rebalancing.
+  void eraseRange(size_t first, size_t last) {
+    size_t n = size();
+
+    if (last > n) {
+      last = n;
+    }
+    if (first >= last) {
+      return;
+    }
+
+    NodePtr head, mid, tail, erased;
+    size_t hhead, hmid, htail, herased;
+    NodePtr whole = root;
+    store(root, TNULL);
+    splitAtRank(whole, blackHeight(whole), first, head, hhead, mid, hmid);
+    splitAtRank(mid, hmid, last - first, erased, herased, tail, htail);
+    destroySubtree(erased);
+    setRoot(joinTrees(head, hhead, tail, htail));
+  }
+
+  // Replaces the contents with the sorted range [first, last) in O(n),
+  // no comparisons. Pass move iterators to hand the keys over.
+  template <class It>
+  void buildSorted(It first, It last) {
+    size_t n = last - first;
+    size_t full = 0;
+
+    // depth of the deepest level that is completely filled
+    while ((size_t(2) << full) - 1 <= n) {
+      full++;
+    }
+    clear();
+    setRoot(buildSubtree(first, n, 0, (size_t(1) << full) - 1 == n ? size_t(-1) : full, TNULL));
+  }
+
+  // The whole-tree operations below move nodes between trees, so both
+  // trees must use equal allocators.
+
+  // Replaces the contents of this tree with left, pivot, right, in that
+  // order, leaving left and right empty. Keys in left must not be
+  // greater than pivot, keys in right not less.
+  void join(RedBlackTree &left, const Key &pivot, RedBlackTree &right) {
+    NodePtr l = left.detach();
+    NodePtr r = right.detach();
+    size_t h;
+
+    clear();
+    setRoot(joinTrees(l, blackHeight(l), createNode(pivot), r, blackHeight(r), h));
+  }
+
+  // Keeps the first rank keys and moves the rest into right.
+  void splitAtRank(size_t rank, RedBlackTree &right) {
+    NodePtr l, r;
+    size_t hl, hr;
+    NodePtr whole = detach();
+
+    right.clear();
+    splitAtRank(whole, blackHeight(whole), rank, l, hl, r, hr);
+    setRoot(l);
+    right.setRoot(r);
+  }
+
+  // Keeps the keys less than key and moves the rest into right.
+  void splitAtKey(KeyArg key, RedBlackTree &right) {
+    NodePtr l, r;
+    size_t hl, hr;
+    NodePtr whole = detach();
+
+    right.clear();
+    splitAtKey(whole, blackHeight(whole), key, l, hl, r, hr);
+    setRoot(l);
+    right.setRoot(r);
+  }
+
+  // Moves every key of other into this tree, duplicates included, in
+  // O(m log(n/m + 1)) for m keys in the smaller tree.
+  void merge(RedBlackTree &other) {
+    if (&other == this) {
+      return;
+    }
+
+    NodePtr a = detach();
+    NodePtr b = other.detach();
+
+    size_t h;
+
+    if (subtreeCount(a) > subtreeCount(b)) {
+      swap(a, b);
+    }
+    setRoot(unionTrees(a, blackHeight(a), b, blackHeight(b), h));
   }
 
   void printTree() {
@@ -497,7 +1140,7 @@ class RedBlackTree {
 };
 
 // int main() {
-//   RedBlackTree bst;
+//   RedBlackTree<string> bst;
 //   bst.insert("0");
 //   bst.insert("1");
 //   bst.insert("2");
@@ -528,4 +1171,6 @@ class RedBlackTree {
 //   bst.printTree();
 //   bst.deleteByIndex(1);
 //   bst.printTree();
-// }
\ No newline at end of file
+// }
+
+#endif
@@ -0,0 +1,316 @@
+#ifndef SHARDED_HPP
+# define SHARDED_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "epoch.hpp"
+#include "fenwick.hpp"
+#include "rbtc.hpp"
+
+// storage split by key range over independent trees, so writers to
+// different ranges run on different cores.
+//
+// Each shard owns a key range for inserts and has its own mutex. The
+// directory lists the shards in key order next to a Fenwick tree of
+// their sizes, so a global index is mapped to (shard, local index) in
+// O(log #shards) and size() is a prefix sum. The directory is replaced as
+// a whole when shards are split or merged and retired through the epoch
+// domain, as are shards merged away; both happen with every shard locked.
+// An operation resolves its shard against the directory without a lock,
+// locks the shard and goes back if the directory has been replaced
+// meanwhile, so ranks and key ranges it acts on are those of the
+// directory still in force, and its count update lands in that
+// directory's Fenwick tree. The price is that all writers share the upper
+// nodes of that tree.
+//
+// A shard that grows past max_shard is split in half. One that drops
+// below a quarter of it is merged into a neighbour, or shares the
+// neighbour's strings evenly when both together would be too big.
+//
+// Ranks are exact while no writer runs. Under concurrent inserts and
+// erases in other shards an index resolves against counts read one node
+// at a time, so it may be off by the number of those in flight; splits
+// and merges never skew it, since they force a retry.
+class sharded_storage
+{
+public:
+    explicit sharded_storage(size_t _max_shard = 1 << 16) :
+        _max_shard(max<size_t>(_max_shard, 4))
+    {
+        directory* dir = new directory(1);
+
+        dir->_shards.push_back(new shard());
+        _dir.store(dir);
+    }
+
+    ~sharded_storage()
+    {
+        directory* dir = _dir.load();
+
+        for (shard* sh : dir->_shards)
+            delete sh;
+        delete dir;
+    }
+
+    sharded_storage(const sharded_storage&) = delete;
+    sharded_storage& operator=(const sharded_storage&) = delete;
+
+    void insert(const string& _str)
+    {
+        insert_string(string(_str));
+    }
+
+    void insert(string&& _str)
+    {
+        insert_string(move(_str));
+    }
+
+    void erase(uint64_t _index)
+    {
+        epoch_guard guard;
+        shard* sh;
+        bool underfull;
+
+        for (;;)
+        {
+            uint64_t local = _index;
+            directory* dir;
+
+            sh = locate(local, dir);
+            if (sh == nullptr)
+                return ;
+
+            lock_guard<mutex> lock(sh->_lock);
+
+            // a split or merge may have moved strings between shards
+            // since local was resolved
+            if (_dir.load(memory_order_acquire) != dir)
+                continue ;
+            if (local < sh->_data.size())
+            {
+                sh->_data.deleteByIndex(local);
+                counted(sh, uint64_t(-1));
+                underfull = sh->_data.size() < _max_shard / 4;
+                break ;
+            }
+        }
+        if (underfull)
+            merge(sh);
+    }
+
+    // the string at _index, or an empty one past the end
+    string get(uint64_t _index)
+    {
+        epoch_guard guard;
+
+        for (;;)
+        {
+            uint64_t local = _index;
+            directory* dir;
+            shard* sh = locate(local, dir);
+
+            if (sh == nullptr)
+                return (string());
+
+            lock_guard<mutex> lock(sh->_lock);
+
+            if (_dir.load(memory_order_acquire) != dir)
+                continue ;
+            return (local < sh->_data.size() ? sh->_data.find(local)->data : string());
+        }
+    }
+
+    uint64_t size()
+    {
+        epoch_guard guard;
+
+        return (_dir.load(memory_order_acquire)->_counts.total());
+    }
+
+    size_t shard_count()
+    {
+        epoch_guard guard;
+
+        return (_dir.load(memory_order_acquire)->_shards.size());
+    }
+
+private:
+    struct shard
+    {
+        mutex _lock;
+        RedBlackTree<string> _data;
+        // smallest key inserts take here, but for the first shard
+        string _low;
+        // position in the current directory
+        size_t _slot;
+        // emptied into a neighbour; only a stale directory still has it
+        bool _merged;
+
+        shard() : _slot(0), _merged(false) {}
+    };
+
+    struct directory
+    {
+        vector<shard*> _shards;
+        // _lows[i] is the smallest key shard i + 1 takes
+        vector<string> _lows;
+        // shard sizes in directory order
+        fenwick<atomic<uint64_t> > _counts;
+
+        explicit directory(size_t _size) : _counts(_size) {}
+    };
+
+    size_t _max_shard;
+    atomic<directory*> _dir;
+    // serializes splits and merges, taken before any shard lock
+    mutex _split_lock;
+
+    void insert_string(string&& _str)
+    {
+        epoch_guard guard;
+        shard* sh;
+        bool full;
+
+        for (;;)
+        {
+            directory* dir = _dir.load(memory_order_acquire);
+
+            sh = dir->_shards[upper_bound(dir->_lows.begin(), dir->_lows.end(), _str) - dir->_lows.begin()];
+
+            lock_guard<mutex> lock(sh->_lock);
+
+            // a split or merge moved the range on after the directory was read
+            if (_dir.load(memory_order_acquire) != dir)
+                continue ;
+            sh->_data.insert(move(_str));
+            counted(sh, 1);
+            full = sh->_data.size() > _max_shard;
+            break ;
+        }
+        if (full)
+            split(sh);
+    }
+
+    // Adds _delta to _sh's size in the directory; _sh->_lock is held, so
+    // no split or merge can publish a new directory meanwhile.
+    void counted(shard* _sh, uint64_t _delta)
+    {
+        _dir.load(memory_order_acquire)->_counts.add(_sh->_slot, _delta);
+    }
+
+    // Descends the directory's Fenwick tree to the shard holding _index and
+    // turns _index into its local index there; nullptr past the end. The
+    // directory used is stored in _dir_used: the answer only holds if it
+    // is still the current one once the shard is locked.
+    shard* locate(uint64_t& _index, directory*& _dir_used)
+    {
+        size_t at;
+
+        _dir_used = _dir.load(memory_order_acquire);
+        at = _dir_used->_counts.find(_index);
+        return (at < _dir_used->_shards.size() ? _dir_used->_shards[at] : nullptr);
+    }
+
+    // Locks every shard of the current directory, in directory order;
+    // _split_lock must be held.
+    vector<unique_lock<mutex> > lock_all()
+    {
+        vector<unique_lock<mutex> > locks;
+
+        for (shard* sh : _dir.load()->_shards)
+            locks.emplace_back(sh->_lock);
+        return (locks);
+    }
+
+    // Publishes _shards as the new directory, with slots and counts taken
+    // from the shards themselves, and retires the old one. Every shard
+    // must be locked.
+    void publish(vector<shard*>&& _shards)
+    {
+        directory* old_dir = _dir.load();
+        directory* dir = new directory(_shards.size());
+        vector<uint64_t> sizes;
+
+        dir->_shards = move(_shards);
+        for (size_t i = 0; i < dir->_shards.size(); i++)
+        {
+            dir->_shards[i]->_slot = i;
+            sizes.push_back(dir->_shards[i]->_data.size());
+            if (i > 0)
+                dir->_lows.push_back(dir->_shards[i]->_low);
+        }
+        dir->_counts.assign(sizes);
+        _dir.store(dir, memory_order_release);
+        epoch_domain::instance().retire(old_dir, &dispose_directory);
+    }
+
+    // Moves the upper half of a full shard into a new one placed right
+    // after it.
+    void split(shard* _full)
+    {
+        lock_guard<mutex> split_lock(_split_lock);
+        vector<unique_lock<mutex> > locks = lock_all();
+        uint64_t size = _full->_data.size();
+
+        if (_full->_merged || size <= _max_shard)
+            return ;
+
+        shard* right = new shard();
+        vector<shard*> shards = _dir.load()->_shards;
+
+        _full->_data.splitAtRank(size / 2, right->_data);
+        right->_low = right->_data.find(0)->data;
+        shards.insert(shards.begin() + _full->_slot + 1, right);
+        publish(move(shards));
+    }
+
+    // Merges an underfull shard with its right neighbour (its left one for
+    // the last shard). If the two together would be over half of
+    // max_shard they are split evenly again instead, so a shard that has
+    // just been merged is not split by the next few inserts.
+    void merge(shard* _under)
+    {
+        lock_guard<mutex> split_lock(_split_lock);
+        vector<unique_lock<mutex> > locks = lock_all();
+        vector<shard*> shards = _dir.load()->_shards;
+
+        if (_under->_merged || shards.size() < 2 || _under->_data.size() >= _max_shard / 4)
+            return ;
+
+        size_t at = _under->_slot + 1 < shards.size() ? _under->_slot : _under->_slot - 1;
+        shard* left = shards[at];
+        shard* right = shards[at + 1];
+        uint64_t total = left->_data.size() + right->_data.size();
+
+        left->_data.merge(right->_data);
+        if (total > _max_shard / 2)
+        {
+            left->_data.splitAtRank(total / 2, right->_data);
+            right->_low = right->_data.find(0)->data;
+            publish(move(shards));
+            return ;
+        }
+        right->_merged = true;
+        shards.erase(shards.begin() + at + 1);
+        publish(move(shards));
+        epoch_domain::instance().retire(right, &dispose_shard);
+    }
+
+    static void dispose_directory(void* _dir)
+    {
+        delete static_cast<directory*>(_dir);
+    }
+
+    static void dispose_shard(void* _shard)
+    {
+        delete static_cast<shard*>(_shard);
+    }
+};
+
+#endif
@@ -0,0 +1,596 @@
+#ifndef STORAGE_HPP
+# define STORAGE_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "fenwick.hpp"
+#include "rbtc.hpp"
+
+// FNV-1a, the checksum of snapshots and log records
+static const uint64_t fnv_offset = 14695981039346656037ULL;
+
+inline uint64_t fnv1a(uint64_t _hash, const char* _bytes, size_t _length)
+{
+    for (size_t i = 0; i < _length; i++)
+    {
+        _hash ^= static_cast<unsigned char>(_bytes[i]);
+        _hash *= 1099511628211ULL;
+    }
+    return (_hash);
+}
+
+// write(2) until everything is out; _path names the file in errors
+inline void write_fully(int _fd, const char* _bytes, size_t _length, const string& _path)
+{
+    while (_length > 0)
+    {
+        ssize_t written = ::write(_fd, _bytes, _length);
+
+        if (written < 0 && errno == EINTR)
+            continue ;
+        if (written < 0)
+            throw runtime_error("cannot write " + _path + ": " + strerror(errno));
+        _bytes += written;
+        _length -= written;
+    }
+}
+
+// fsyncs the directory holding _path, which makes a rename or a newly
+// created file there survive a crash and not only the file's contents
+inline void sync_directory(const string& _path)
+{
+    size_t slash = _path.rfind('/');
+    string dir = slash == string::npos ? "." : slash == 0 ? "/" : _path.substr(0, slash);
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+
+    if (fd < 0)
+        throw runtime_error("cannot open " + dir + ": " + strerror(errno));
+    if (::fsync(fd) != 0)
+    {
+        int error = errno;
+
+        ::close(fd);
+        throw runtime_error("cannot sync " + dir + ": " + strerror(error));
+    }
+    ::close(fd);
+}
+
+// rename(2) of _from over _to, then sync_directory
+inline void rename_durably(const string& _from, const string& _to)
+{
+    if (::rename(_from.c_str(), _to.c_str()) != 0)
+        throw runtime_error("cannot rename " + _from + ": " + strerror(errno));
+    sync_directory(_to);
+}
+
+class storage
+{
+public:
+    void insert(const string& _str)
+    {
+        thaw();
+        inserted(_data.insert(_str));
+        _data.printTree();
+    }
+
+    void insert(string&& _str)
+    {
+        thaw();
+        inserted(_data.insert(move(_str)));
+        _data.printTree();
+    }
+
+    template <typename... Args>
+    void emplace(Args&&... _args)
+    {
+        thaw();
+        inserted(_data.emplace(forward<Args>(_args)...));
+        _data.printTree();
+    }
+
+    void erase(uint64_t _index)
+    {
+        thaw();
+        if (_index < _data.size())
+        {
+            RedBlackTree<string>::NodePtr node = seek(_index);
+
+            // the successor moves up into _index
+            _finger = _index + 1 < _data.size() ? _data.successor(node) : nullptr;
+            _data.erase(node);
+        }
+        _data.printTree();
+    }
+
+    // Same result as erase(op.first) followed by insert(op.second) for
+    // every op in order. The batch's strings are sorted once up front and
+    // a Fenwick tree over that order marks the ones inserted so far, so an
+    // erase index resolves to a pending string or an original rank in
+    // O(log k log n) without shifting anything. Originals are erased on
+    // the spot; the pending strings left at the end are built into one
+    // tree and merged in a single sweep.
+    void apply_batch(vector<pair<uint64_t, string> > _ops)
+    {
+        vector<size_t> order(_ops.size());
+        vector<size_t> slot(_ops.size());
+        fenwick<> present(_ops.size());
+
+        thaw();
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = i;
+        // stable, so equal strings keep the order they were inserted in
+        stable_sort(order.begin(), order.end(), [&_ops](size_t _a, size_t _b) {
+            return (_ops[_a].second < _ops[_b].second);
+        });
+        for (size_t i = 0; i < order.size(); i++)
+            slot[order[i]] = i;
+        for (size_t i = 0; i < _ops.size(); i++)
+        {
+            if (_ops[i].first < _data.size() + present.total())
+                batch_erase(_ops[i].first, _ops, order, present);
+            present.add(slot[i], 1);
+        }
+
+        vector<string> pending;
+        uint64_t taken = 0;
+
+        pending.reserve(present.total());
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            if (present.prefix(i + 1) > taken)
+            {
+                pending.push_back(move(_ops[order[i]].second));
+                taken++;
+            }
+        }
+
+        RedBlackTree<string> inserted;
+
+        inserted.buildSorted(make_move_iterator(pending.begin()), make_move_iterator(pending.end()));
+        _data.merge(inserted);
+        _finger = nullptr;
+        _data.printTree();
+    }
+
+    // erases the strings at indices [_first_index, _last_index) in
+    // O(log n + k)
+    void erase_range(uint64_t _first_index, uint64_t _last_index)
+    {
+        thaw();
+        _data.eraseRange(_first_index, _last_index);
+        _finger = nullptr;
+        _data.printTree();
+    }
+
+    // keeps the first _rank strings, moves the rest into _right
+    void split_at_rank(uint64_t _rank, storage& _right)
+    {
+        thaw();
+        _right.thaw();
+        _data.splitAtRank(_rank, _right._data);
+        _finger = nullptr;
+        _right._finger = nullptr;
+    }
+
+    // keeps the strings less than _key, moves the rest into _right
+    void split_at_key(const string& _key, storage& _right)
+    {
+        thaw();
+        _right.thaw();
+        _data.splitAtKey(_key, _right._data);
+        _finger = nullptr;
+        _right._finger = nullptr;
+    }
+
+    // becomes _left + _pivot + _right, both of which are emptied
+    void join(storage& _left, const string& _pivot, storage& _right)
+    {
+        thaw();
+        _left.thaw();
+        _right.thaw();
+        _data.join(_left._data, _pivot, _right._data);
+        _finger = nullptr;
+        _left._finger = nullptr;
+        _right._finger = nullptr;
+    }
+
+    // moves every string of _other in here
+    void merge(storage& _other)
+    {
+        thaw();
+        _other.thaw();
+        _data.merge(_other._data);
+        _finger = nullptr;
+        _other._finger = nullptr;
+    }
+
+    const string& get(uint64_t _index)
+    {
+        if (_is_frozen)
+            return (_index < _frozen.size() ? _frozen[_index] : empty_string());
+        return (seek(_index)->data);
+    }
+
+    // Moves every string out of the tree into one sorted array for a
+    // read-only phase: get becomes an array access and scans walk
+    // memory in order. The tree is freed. Anything that modifies the
+    // storage thaws it first.
+    void freeze()
+    {
+        if (_is_frozen)
+            return ;
+
+        RedBlackTree<string>::NodePtr node = _data.find(0);
+
+        _frozen.reserve(_data.size());
+        for (uint64_t i = 0; i < _data.size(); i++, node = _data.successor(node))
+            _frozen.push_back(move(node->data));
+        _data.clear();
+        _finger = nullptr;
+        _is_frozen = true;
+    }
+
+    // Rebuilds the tree from the frozen array in O(n), without comparing
+    // keys. Does nothing unless frozen.
+    void thaw()
+    {
+        if (!_is_frozen)
+            return ;
+        _data.buildSorted(make_move_iterator(_frozen.begin()), make_move_iterator(_frozen.end()));
+        vector<string>().swap(_frozen);
+        _is_frozen = false;
+    }
+
+    bool frozen() const
+    {
+        return (_is_frozen);
+    }
+
+    // Strings at _indices, in request order; nullptr for indices past the
+    // end. The indices are sorted and resolved in one traversal.
+    vector<const string*> get_many(const vector<uint64_t>& _indices)
+    {
+        return (get_many(_indices, 1));
+    }
+
+    // Same, with the sorted indices split across up to _threads threads.
+    // The storage must not be modified while it runs.
+    vector<const string*> get_many(const vector<uint64_t>& _indices, unsigned _threads)
+    {
+        size_t n = _indices.size();
+        vector<size_t> order(n);
+        vector<uint64_t> sorted(n);
+        vector<RedBlackTree<string>::NodePtr> nodes(n);
+        vector<const string*> result(n);
+
+        if (_is_frozen)
+        {
+            for (size_t i = 0; i < n; i++)
+                result[i] = _indices[i] < _frozen.size() ? &_frozen[_indices[i]] : nullptr;
+            return (result);
+        }
+        for (size_t i = 0; i < n; i++)
+            order[i] = i;
+        sort(order.begin(), order.end(), [&_indices](size_t _a, size_t _b) {
+            return (_indices[_a] < _indices[_b]);
+        });
+        for (size_t i = 0; i < n; i++)
+            sorted[i] = _indices[order[i]];
+
+        // each thread takes a contiguous slice, so it still shares path
+        // prefixes within its own part of the tree
+        _threads = max(1u, min<unsigned>(_threads, n / get_many_chunk));
+        if (_threads == 1)
+            _data.findSorted(sorted.begin(), sorted.end(), nodes.data());
+        else
+        {
+            vector<thread> workers;
+
+            for (unsigned t = 0; t < _threads; t++)
+            {
+                size_t first = n * t / _threads;
+                size_t last = n * (t + 1) / _threads;
+
+                workers.emplace_back([this, &sorted, &nodes, first, last]() {
+                    _data.findSorted(sorted.begin() + first, sorted.begin() + last, nodes.data() + first);
+                });
+            }
+            for (thread& worker : workers)
+                worker.join();
+        }
+
+        for (size_t i = 0; i < n; i++)
+            result[order[i]] = sorted[i] < _data.size() ? &nodes[i]->data : nullptr;
+        return (result);
+    }
+
+    // index the first string not less than _key has, or would get
+    uint64_t index_of(const string& _key)
+    {
+        return (count_less(_key));
+    }
+
+    uint64_t count_less(const string& _key)
+    {
+        if (_is_frozen)
+            return (lower_bound(_frozen.begin(), _frozen.end(), _key) - _frozen.begin());
+        return (_data.countLess(_key));
+    }
+
+    // number of strings in [_lo, _hi)
+    uint64_t count_range(const string& _lo, const string& _hi)
+    {
+        if (!(_lo < _hi))
+            return (0);
+        return (count_less(_hi) - count_less(_lo));
+    }
+
+    uint64_t size() const
+    {
+        return (_is_frozen ? _frozen.size() : _data.size());
+    }
+
+    // Writes every string in order to _path as
+    //   magic, count, { length, bytes } * count, FNV-1a of the records
+    // with integers in native byte order. The file is written next to
+    // _path and renamed over it once synced, so a crash leaves either the
+    // old checkpoint or the new one; the new one is durable once save
+    // returns. Throws runtime_error on I/O errors.
+    void save(const string& _path)
+    {
+        string tmp = _path + ".tmp";
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if (fd < 0)
+            throw runtime_error("cannot create " + tmp + ": " + strerror(errno));
+
+        vector<char> buffer;
+        uint64_t hash = fnv_offset;
+        uint64_t count = size();
+        RedBlackTree<string>::NodePtr node = _data.find(0);
+
+        buffer.reserve(snapshot_buffer + 64);
+        append(buffer, snapshot_magic(), magic_length);
+        append(buffer, &count, sizeof(count));
+        try
+        {
+            for (uint64_t i = 0; i < count; i++)
+            {
+                const string& str = _is_frozen ? _frozen[i] : node->data;
+                uint64_t length = str.size();
+                size_t start = buffer.size();
+
+                if (!_is_frozen)
+                    node = _data.successor(node);
+                append(buffer, &length, sizeof(length));
+                append(buffer, str.data(), length);
+                hash = fnv1a(hash, buffer.data() + start, buffer.size() - start);
+                if (buffer.size() >= snapshot_buffer)
+                {
+                    write_fully(fd, buffer.data(), buffer.size(), tmp);
+                    buffer.clear();
+                }
+            }
+            append(buffer, &hash, sizeof(hash));
+            write_fully(fd, buffer.data(), buffer.size(), tmp);
+            if (::fsync(fd) != 0)
+                throw runtime_error("cannot sync " + tmp + ": " + strerror(errno));
+        }
+        catch (...)
+        {
+            ::close(fd);
+            ::unlink(tmp.c_str());
+            throw ;
+        }
+        ::close(fd);
+        rename_durably(tmp, _path);
+    }
+
+    // Replaces the contents with a snapshot written by save. The file is
+    // mapped, checked against its checksum and built into a tree in O(n)
+    // without comparing keys. Throws runtime_error, leaving the storage
+    // as it was, if the file is missing, truncated or corrupt.
+    void load(const string& _path)
+    {
+        int fd = ::open(_path.c_str(), O_RDONLY);
+        struct stat st;
+
+        if (fd < 0)
+            throw runtime_error("cannot open " + _path + ": " + strerror(errno));
+        if (::fstat(fd, &st) != 0)
+        {
+            ::close(fd);
+            throw runtime_error("cannot stat " + _path + ": " + strerror(errno));
+        }
+
+        size_t length = st.st_size;
+        size_t header = magic_length + sizeof(uint64_t);
+
+        if (length < header + sizeof(uint64_t))
+        {
+            ::close(fd);
+            throw runtime_error(_path + ": not a storage snapshot");
+        }
+
+        void* map = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        ::close(fd);
+        if (map == MAP_FAILED)
+            throw runtime_error("cannot map " + _path + ": " + strerror(errno));
+        ::madvise(map, length, MADV_SEQUENTIAL);
+
+        vector<string> strings;
+
+        try
+        {
+            strings = parse_snapshot(static_cast<const char*>(map), length, _path);
+        }
+        catch (...)
+        {
+            ::munmap(map, length);
+            throw ;
+        }
+        ::munmap(map, length);
+        vector<string>().swap(_frozen);
+        _is_frozen = false;
+        _data.buildSorted(make_move_iterator(strings.begin()), make_move_iterator(strings.end()));
+        _finger = nullptr;
+    }
+
+private:
+    // The last node get or erase reached and its index. Most accesses
+    // land near the previous one, so seek starts from here instead of
+    // the root; anything that reshapes the tree wholesale drops it.
+    RedBlackTree<string>::NodePtr seek(uint64_t _index)
+    {
+        RedBlackTree<string>::NodePtr node;
+
+        if (_index >= _data.size())
+            return (_data.find(_index));
+        if (_finger == nullptr)
+            node = _data.find(_index);
+        else
+            node = _data.findNear(_finger, ptrdiff_t(_index - _finger_rank));
+        _finger = node;
+        _finger_rank = _index;
+        return (node);
+    }
+
+    // a new string before the finger pushes its index up by one
+    void inserted(RedBlackTree<string>::NodePtr _node)
+    {
+        if (_finger != nullptr && _node->data < _finger->data)
+            _finger_rank++;
+    }
+
+    // Index the batch string in sorted slot _slot has, or would have once
+    // inserted, in the batch's current view. Equal strings already in the
+    // tree sort before it, as they would had it been inserted for real.
+    uint64_t batch_index(const vector<pair<uint64_t, string> >& _ops, const vector<size_t>& _order,
+        size_t _slot, const fenwick<>& _present)
+    {
+        return (_present.prefix(_slot) + _data.countLessEqual(_ops[_order[_slot]].second));
+    }
+
+    // Erases index _index of the batch's current view: either drops a
+    // pending string or erases an original one from the tree.
+    void batch_erase(uint64_t _index, const vector<pair<uint64_t, string> >& _ops, const vector<size_t>& _order,
+        fenwick<>& _present)
+    {
+        size_t lo = 0;
+        size_t hi = _order.size();
+
+        // first slot at or after _index; batch_index grows with the slot
+        while (lo < hi)
+        {
+            size_t mid = lo + (hi - lo) / 2;
+
+            if (batch_index(_ops, _order, mid, _present) < _index)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        uint64_t before = _present.prefix(lo);
+        uint64_t unit = before;
+        size_t next = _present.find(unit);
+
+        if (next < _order.size() && batch_index(_ops, _order, next, _present) == _index)
+        {
+            _present.add(next, uint64_t(-1));
+            return ;
+        }
+        // the pending strings before it are the only ones ahead of it
+        _data.deleteByIndex(_index - before);
+    }
+
+    static vector<string> parse_snapshot(const char* _data_begin, size_t _length, const string& _path)
+    {
+        const char* pos = _data_begin + magic_length;
+        const char* records = pos + sizeof(uint64_t);
+        const char* end = _data_begin + _length - sizeof(uint64_t);
+        uint64_t count;
+        uint64_t hash;
+
+        if (memcmp(_data_begin, snapshot_magic(), magic_length) != 0)
+            throw runtime_error(_path + ": not a storage snapshot");
+        memcpy(&count, pos, sizeof(count));
+        memcpy(&hash, end, sizeof(hash));
+        if (fnv1a(fnv_offset, records, end - records) != hash)
+            throw runtime_error(_path + ": checksum mismatch");
+
+        // every record takes at least its length field
+        if (count > static_cast<uint64_t>(end - records) / sizeof(uint64_t))
+            throw runtime_error(_path + ": truncated snapshot");
+
+        vector<string> strings;
+
+        strings.reserve(count);
+        pos = records;
+        for (uint64_t i = 0; i < count; i++)
+        {
+            uint64_t length;
+
+            if (static_cast<size_t>(end - pos) < sizeof(length))
+                throw runtime_error(_path + ": truncated snapshot");
+            memcpy(&length, pos, sizeof(length));
+            pos += sizeof(length);
+            if (static_cast<uint64_t>(end - pos) < length)
+                throw runtime_error(_path + ": truncated snapshot");
+            strings.emplace_back(pos, length);
+            pos += length;
+        }
+        if (pos != end)
+            throw runtime_error(_path + ": trailing bytes in snapshot");
+        return (strings);
+    }
+
+    static void append(vector<char>& _buffer, const void* _bytes, size_t _length)
+    {
+        const char* bytes = static_cast<const char*>(_bytes);
+
+        _buffer.insert(_buffer.end(), bytes, bytes + _length);
+    }
+
+    static const size_t magic_length = 8;
+
+    static const char* snapshot_magic()
+    {
+        return ("STORSNP1");
+    }
+
+    // what get returns past the end of a frozen storage
+    static const string& empty_string()
+    {
+        static const string empty;
+
+        return (empty);
+    }
+
+    // bytes gathered before each write
+    static const size_t snapshot_buffer = 1 << 20;
+
+    // fewest indices worth a thread of their own in get_many
+    static const size_t get_many_chunk = 1 << 12;
+
+    RedBlackTree<string> _data;
+    RedBlackTree<string>::NodePtr _finger = nullptr;
+    uint64_t _finger_rank = 0;
+    // the strings while frozen, when _data is empty
+    vector<string> _frozen;
+    bool _is_frozen = false;
+};
+
+#endif
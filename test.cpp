@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <string>
 #include <vector>
 #include <utility>
@@ -5,7 +6,7 @@
 #include <iostream>
 #include <fstream>
 #include <set>
-#include "rbtc.hpp"
+#include "storage.hpp"
 
 using namespace std;
 using namespace chrono;
@@ -52,30 +53,6 @@ struct node
   struct node *next;
 };
 
-class storage
-{
-public:
-    void insert(const string& _str)
-    {
-        _data.insert(_str);
-        _data.printTree();
-    }
-
-    void erase(uint64_t _index)
-    {
-        _data.deleteByIndex(_index);
-        _data.printTree();
-    }
-
-    const string& get(uint64_t _index)
-    {
-        return (_data.find(_index)->data);
-    }
-
-private:
-    RedBlackTree _data;
-};
-
 int main()
 {
     cout << "TEST TYPE: " << TEST_TYPE << endl;
@@ -87,20 +64,20 @@ int main()
 
     std::cout << "inserting\n";
     int ct = 0;
-    for (const string& item : write)
+    for (string& item : write)
     {
         ct++;
-        st.insert(item);
+        st.insert(move(item));
         std::cout << std::endl << "---- INSERTING: " << ct << endl;
     }
 
     uint64_t progress = 0;
-    uint64_t percent = modify.size() / 100;
+    uint64_t percent = max<uint64_t>(modify.size() / 100, 1);
 
     time_point<system_clock> time;
     nanoseconds total_time(0);
 
-    modify_sequence::const_iterator mitr = modify.begin();
+    modify_sequence::iterator mitr = modify.begin();
     read_sequence::const_iterator ritr = read.begin();
     ct = 0;
     std::cout << "=== TEST BEGIN ====" << std::endl;
@@ -112,7 +89,7 @@ int main()
         // std::cout << "erased in " << (time - system_clock::now()).count() << endl;
         time = system_clock::now();
         std::cout << std::endl << "+++++ INSERTING +++++ " << mitr->second << std::endl;
-        st.insert(mitr->second);
+        st.insert(move(mitr->second));
         std::cout << std::endl << "===== DONE ====== " << ++ct << std::endl;
 
         // std::cout << "inserted in " << (time - system_clock::now()).count() << endl;
@@ -0,0 +1,490 @@
+#ifndef WAL_HPP
+# define WAL_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "storage.hpp"
+
+using namespace std::chrono;
+
+// Append-only log of storage modifications with group commit.
+//
+// Records are gathered in memory and a flusher thread writes and
+// fdatasyncs them once per interval, so any number of modifications in
+// that window share one sync. A modification is therefore durable at
+// most one interval after it returns; sync() waits for it explicitly.
+// An interval of zero syncs every record before append returns.
+//
+// File layout: magic, id of the checkpoint the log applies on top of,
+// then records of
+//   FNV-1a of the rest, payload length, type, payload
+// in native byte order. Replay stops at the first torn or corrupt
+// record, which a crash can only leave at the end. A checkpoint record
+// closes a log whose contents are about to be saved as a checkpoint.
+class write_ahead_log
+{
+public:
+    enum record_type { erase_record = 'E', insert_record = 'I', checkpoint_record = 'C' };
+
+    static const size_t header_length = 16;
+
+    // Takes over _fd, positioned at the end of the valid log.
+    write_ahead_log(int _file, const string& _name, microseconds _group_commit) :
+        _fd(_file), _path(_name), _interval(_group_commit), _appended(0), _durable(0), _stop(false), _force(false)
+    {
+        if (_interval.count() > 0)
+            _flusher = thread(&write_ahead_log::flush_loop, this);
+    }
+
+    ~write_ahead_log()
+    {
+        {
+            lock_guard<mutex> lock(_lock);
+            _stop = true;
+        }
+        _wake.notify_all();
+        if (_flusher.joinable())
+            _flusher.join();
+        else
+        {
+            try
+            {
+                flush();
+            }
+            catch (...)
+            {
+            }
+        }
+        ::close(_fd);
+    }
+
+    write_ahead_log(const write_ahead_log&) = delete;
+    write_ahead_log& operator=(const write_ahead_log&) = delete;
+
+    void append_erase(uint64_t _index)
+    {
+        append(erase_record, reinterpret_cast<const char*>(&_index), sizeof(_index));
+    }
+
+    void append_insert(const string& _str)
+    {
+        append(insert_record, _str.data(), _str.size());
+    }
+
+    void append_checkpoint()
+    {
+        append(checkpoint_record, nullptr, 0);
+    }
+
+    // returns once everything appended so far is on disk
+    void sync()
+    {
+        if (!_flusher.joinable())
+            return ;
+
+        unique_lock<mutex> lock(_lock);
+        uint64_t target = _appended;
+
+        _force = true;
+        _wake.notify_all();
+        _synced.wait(lock, [&]() { return (_durable >= target || !_error.empty()); });
+        check();
+    }
+
+    static void write_header(int _fd, uint64_t _base, const string& _path)
+    {
+        char header[header_length];
+
+        memcpy(header, magic(), 8);
+        memcpy(header + 8, &_base, sizeof(_base));
+        write_fully(_fd, header, header_length, _path);
+    }
+
+    // Whether _log starts with a whole header, and if so whether it is a
+    // log at all and which checkpoint it applies on top of.
+    static bool read_header(const char* _log, size_t _length, bool& _is_log, uint64_t& _base)
+    {
+        if (_length < header_length)
+            return (false);
+        _is_log = memcmp(_log, magic(), 8) == 0;
+        memcpy(&_base, _log + 8, sizeof(_base));
+        return (true);
+    }
+
+    // Checks the header against _base, hands every intact record to
+    // _apply(type, payload, length) and returns where the valid log ends,
+    // or 0 if the log is missing, foreign or for another checkpoint.
+    template <typename Apply>
+    static size_t replay(const char* _log, size_t _length, uint64_t _base, Apply _apply)
+    {
+        uint64_t base;
+        bool is_log;
+
+        if (!read_header(_log, _length, is_log, base) || !is_log || base != _base)
+            return (0);
+
+        size_t pos = header_length;
+
+        for (;;)
+        {
+            uint64_t hash;
+            uint32_t length;
+
+            if (_length - pos < sizeof(hash) + sizeof(length) + 1)
+                return (pos);
+            memcpy(&hash, _log + pos, sizeof(hash));
+            memcpy(&length, _log + pos + sizeof(hash), sizeof(length));
+            if (_length - pos - sizeof(hash) - sizeof(length) < static_cast<size_t>(length) + 1
+                || fnv1a(fnv_offset, _log + pos + sizeof(hash), sizeof(length) + 1 + length) != hash)
+                return (pos);
+
+            const char* record = _log + pos + sizeof(hash) + sizeof(length);
+
+            _apply(static_cast<record_type>(record[0]), record + 1, length);
+            pos += sizeof(hash) + sizeof(length) + 1 + length;
+        }
+    }
+
+private:
+    int _fd;
+    string _path;
+    microseconds _interval;
+    mutex _lock;
+    condition_variable _wake;
+    condition_variable _synced;
+    vector<char> _buffer;
+    vector<char> _spare;
+    uint64_t _appended;
+    uint64_t _durable;
+    bool _stop;
+    bool _force;
+    string _error;
+    thread _flusher;
+
+    static const char* magic()
+    {
+        return ("STORWAL1");
+    }
+
+    void append(record_type _type, const char* _payload, uint32_t _length)
+    {
+        char head[sizeof(uint64_t) + sizeof(uint32_t) + 1];
+        char type = static_cast<char>(_type);
+
+        memcpy(head + sizeof(uint64_t), &_length, sizeof(_length));
+        head[sizeof(head) - 1] = type;
+
+        uint64_t hash = fnv1a(fnv1a(fnv_offset, head + sizeof(uint64_t), sizeof(_length) + 1), _payload, _length);
+
+        memcpy(head, &hash, sizeof(hash));
+
+        unique_lock<mutex> lock(_lock);
+
+        check();
+        _buffer.insert(_buffer.end(), head, head + sizeof(head));
+        _buffer.insert(_buffer.end(), _payload, _payload + _length);
+        _appended++;
+        if (!_flusher.joinable())
+        {
+            lock.unlock();
+            flush();
+        }
+    }
+
+    void check()
+    {
+        if (!_error.empty())
+            throw runtime_error(_error);
+    }
+
+    // Writes and syncs whatever is buffered. Appends go on into the other
+    // buffer meanwhile; that is what groups them into the next sync. Only
+    // one flush runs at a time, so _spare is the flusher's own.
+    void flush()
+    {
+        uint64_t target;
+
+        {
+            lock_guard<mutex> lock(_lock);
+            _spare.swap(_buffer);
+            target = _appended;
+        }
+        if (!_spare.empty())
+        {
+            write_fully(_fd, _spare.data(), _spare.size(), _path);
+            _spare.clear();
+            if (::fdatasync(_fd) != 0)
+                throw runtime_error("cannot sync " + _path + ": " + strerror(errno));
+        }
+
+        lock_guard<mutex> lock(_lock);
+        _durable = target;
+        _synced.notify_all();
+    }
+
+    void flush_loop()
+    {
+        for (;;)
+        {
+            bool stop;
+            {
+                unique_lock<mutex> lock(_lock);
+
+                _wake.wait_for(lock, _interval, [&]() { return (_stop || _force); });
+                _force = false;
+                stop = _stop;
+            }
+            try
+            {
+                flush();
+            }
+            catch (const exception& e)
+            {
+                lock_guard<mutex> lock(_lock);
+                _error = e.what();
+                _synced.notify_all();
+                return ;
+            }
+            if (stop)
+                return ;
+        }
+    }
+};
+
+// storage whose modifications survive crashes: <_prefix>.ckpt holds the
+// last checkpoint and <_prefix>.wal everything since, and the constructor
+// rebuilds the state from both. At the default group commit interval of
+// 10 ms, bench wal measured the log at under a tenth of the in-memory
+// cost of an erase + insert pair; a shorter interval trades throughput
+// for a smaller window of modifications a crash can lose.
+class logged_storage
+{
+public:
+    explicit logged_storage(const string& _prefix, microseconds _group_commit = milliseconds(10)) :
+        _checkpoint_path(_prefix + ".ckpt"), _log_path(_prefix + ".wal"), _interval(_group_commit)
+    {
+        uint64_t base = 0;
+
+        if (::access(_checkpoint_path.c_str(), F_OK) == 0)
+        {
+            _data.load(_checkpoint_path);
+            base = checkpoint_id();
+        }
+        recover(base);
+    }
+
+    void insert(const string& _str)
+    {
+        _log->append_insert(_str);
+        _data.insert(_str);
+    }
+
+    void insert(string&& _str)
+    {
+        _log->append_insert(_str);
+        _data.insert(move(_str));
+    }
+
+    void erase(uint64_t _index)
+    {
+        if (_index >= _data.size())
+            return ;
+        _log->append_erase(_index);
+        _data.erase(_index);
+    }
+
+    const string& get(uint64_t _index)
+    {
+        return (_data.get(_index));
+    }
+
+    uint64_t size() const
+    {
+        return (_data.size());
+    }
+
+    // waits until every modification so far is durable
+    void sync()
+    {
+        _log->sync();
+    }
+
+    // Saves a checkpoint and starts an empty log on top of it. The old
+    // log is closed with a checkpoint record first, and the checkpoint's
+    // rename is durable before the new log's is, so a crash in between
+    // leaves a closed log naming the previous checkpoint, which recovery
+    // then skips: everything in it is in the new checkpoint.
+    void checkpoint()
+    {
+        _log->append_checkpoint();
+        _log->sync();
+        _data.save(_checkpoint_path);
+
+        string tmp = _log_path + ".tmp";
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if (fd < 0)
+            throw runtime_error("cannot create " + tmp + ": " + strerror(errno));
+        try
+        {
+            write_ahead_log::write_header(fd, checkpoint_id(), tmp);
+            if (::fsync(fd) != 0)
+                throw runtime_error("cannot sync " + tmp + ": " + strerror(errno));
+        }
+        catch (...)
+        {
+            ::close(fd);
+            throw ;
+        }
+        ::close(fd);
+        rename_durably(tmp, _log_path);
+        _log.reset();
+        open_log(write_ahead_log::header_length);
+    }
+
+private:
+    string _checkpoint_path;
+    string _log_path;
+    microseconds _interval;
+    storage _data;
+    unique_ptr<write_ahead_log> _log;
+
+    // A checkpoint is named by its checksum, the last 8 bytes of the file.
+    uint64_t checkpoint_id()
+    {
+        int fd = ::open(_checkpoint_path.c_str(), O_RDONLY);
+        struct stat st;
+        uint64_t id;
+
+        if (fd < 0)
+            throw runtime_error("cannot open " + _checkpoint_path + ": " + strerror(errno));
+        if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(id))
+            || ::pread(fd, &id, sizeof(id), st.st_size - sizeof(id)) != static_cast<ssize_t>(sizeof(id)))
+        {
+            ::close(fd);
+            throw runtime_error("cannot read " + _checkpoint_path);
+        }
+        ::close(fd);
+        return (id);
+    }
+
+    // Replays the log if it continues the loaded checkpoint and cuts off a
+    // torn tail. A missing or headerless log, or a closed one for an older
+    // checkpoint, is replaced by a fresh one. Anything else would mean
+    // dropping modifications the checkpoint does not have, so it throws
+    // runtime_error instead.
+    void recover(uint64_t _base)
+    {
+        int fd = ::open(_log_path.c_str(), O_RDWR | O_CREAT, 0644);
+        struct stat st;
+
+        if (fd < 0)
+            throw runtime_error("cannot open " + _log_path + ": " + strerror(errno));
+        if (::fstat(fd, &st) != 0)
+        {
+            ::close(fd);
+            throw runtime_error("cannot stat " + _log_path + ": " + strerror(errno));
+        }
+
+        vector<char> log(st.st_size);
+        size_t read_so_far = 0;
+
+        while (read_so_far < log.size())
+        {
+            ssize_t got = ::pread(fd, log.data() + read_so_far, log.size() - read_so_far, read_so_far);
+
+            if (got <= 0)
+                break;
+            read_so_far += got;
+        }
+
+        bool is_log = false;
+        uint64_t base = _base;
+
+        if (write_ahead_log::read_header(log.data(), read_so_far, is_log, base)
+            && (!is_log || (base != _base && !closed(log.data(), read_so_far, base))))
+        {
+            ::close(fd);
+            throw runtime_error(_log_path + (is_log ? " does not continue " + _checkpoint_path : " is not a log"));
+        }
+
+        size_t end = write_ahead_log::replay(log.data(), read_so_far, _base,
+            [this](write_ahead_log::record_type _type, const char* _payload, uint32_t _length) {
+                uint64_t index;
+
+                if (_type == write_ahead_log::erase_record && _length == sizeof(index))
+                {
+                    memcpy(&index, _payload, sizeof(index));
+                    _data.erase(index);
+                }
+                else if (_type == write_ahead_log::insert_record)
+                    _data.insert(string(_payload, _length));
+            });
+
+        ::close(fd);
+        if (end == 0)
+        {
+            fd = ::open(_log_path.c_str(), O_WRONLY | O_TRUNC);
+            if (fd < 0)
+                throw runtime_error("cannot open " + _log_path + ": " + strerror(errno));
+            try
+            {
+                write_ahead_log::write_header(fd, _base, _log_path);
+            }
+            catch (...)
+            {
+                ::close(fd);
+                throw ;
+            }
+            if (::fsync(fd) != 0)
+            {
+                ::close(fd);
+                throw runtime_error("cannot sync " + _log_path + ": " + strerror(errno));
+            }
+            ::close(fd);
+            sync_directory(_log_path);
+            end = write_ahead_log::header_length;
+        }
+        open_log(end);
+    }
+
+    // whether the last intact record of the log for checkpoint _base is
+    // a checkpoint record
+    static bool closed(const char* _log, size_t _length, uint64_t _base)
+    {
+        write_ahead_log::record_type last = write_ahead_log::insert_record;
+
+        write_ahead_log::replay(_log, _length, _base,
+            [&last](write_ahead_log::record_type _type, const char*, uint32_t) { last = _type; });
+        return (last == write_ahead_log::checkpoint_record);
+    }
+
+    // opens the log for appending after its first _end valid bytes
+    void open_log(size_t _end)
+    {
+        int fd = ::open(_log_path.c_str(), O_WRONLY);
+
+        if (fd < 0)
+            throw runtime_error("cannot open " + _log_path + ": " + strerror(errno));
+        if (::ftruncate(fd, _end) != 0 || ::lseek(fd, _end, SEEK_SET) < 0 || ::fdatasync(fd) != 0)
+        {
+            ::close(fd);
+            throw runtime_error("cannot prepare " + _log_path + ": " + strerror(errno));
+        }
+        _log.reset(new write_ahead_log(fd, _log_path, _interval));
+    }
+};
+
+#endif